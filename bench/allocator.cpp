@@ -0,0 +1,72 @@
+#include <memory>
+
+#include <bench.hpp>
+#include <luapp/allocator.hpp>
+
+namespace
+{
+
+using namespace lua;
+
+// Builds and drops many small tables and strings, as allocation-heavy scripts do.
+constexpr auto churn = R"lua(
+  local t
+  for i = 1, 100 do t = { i, tostring(i), { x = i } } end
+  return #t[2]
+)lua";
+
+auto raw_churn() -> bench::body
+{
+  auto L = bench::raw_state();
+  luaL_loadstring(L.get(), churn);
+  const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+  return [L, ref](std::size_t n) {
+    const auto state = L.get();
+    for (std::size_t i = 0; i < n; ++i) {
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pcall(state, 0, LUA_MULTRET, 0);
+      bench::keep(lua_tointeger(state, -1));
+      lua_settop(state, 0);
+    }
+  };
+}
+
+auto luapp_churn(std::shared_ptr<allocator> alloc) -> bench::body
+{
+  state s(std::move(alloc));
+  return [s, c = s.load(churn)](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      bench::keep(c.call(tuple{}));
+  };
+}
+
+const bench::registrar churn_pool{
+  "allocator.churn.pool", [] { return luapp_churn(std::make_shared<pool_allocator>()); },
+  raw_churn};
+
+const bench::registrar churn_default{
+  "allocator.churn.default", [] { return luapp_churn(std::make_shared<default_allocator>()); },
+  raw_churn};
+
+// Whole lifetime of a short-lived state: open, run once, close.
+const bench::registrar lifecycle_arena{
+  "allocator.lifecycle.arena",
+  [] {
+    return [](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        const state s(std::make_shared<arena_allocator>(256 * 1024));
+        bench::keep(s.do_string(churn));
+      }
+    };
+  },
+  [] {
+    return [](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        const auto L = bench::raw_state();
+        luaL_dostring(L.get(), churn);
+        bench::keep(lua_tointeger(L.get(), -1));
+      }
+    };
+  }};
+
+} // namespace
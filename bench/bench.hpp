@@ -0,0 +1,76 @@
+#ifndef LUAPP_BENCH_BENCH_HPP_INCLUDED
+#define LUAPP_BENCH_BENCH_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+#include <luapp/state.hpp>
+#include <luapp/value.hpp>
+
+namespace lua::detail
+{
+
+// Gives the benchmark access to the stack-level primitives that are not part of the public API.
+struct access
+{
+  static auto data(const state& s) -> state_data& { return *s.data_; }
+
+  static auto push(const value& v, state_data& sdata) -> int { return v.push(sdata); }
+
+  static auto push(const function& f, state_data& sdata) -> int { return f.push(sdata); }
+
+  static auto at(state_data& sdata, int index) -> value { return value::at(sdata, index); }
+};
+
+} // namespace lua::detail
+
+namespace bench
+{
+
+// Runs the measured operation n times.
+using body = std::function<void(std::size_t)>;
+
+// Prepares a body.  Everything done here is excluded from the measurement.
+using fixture = std::function<body()>;
+
+struct entry
+{
+  std::string name;
+  fixture luapp;
+  fixture raw;
+};
+
+auto registry() -> std::vector<entry>&;
+
+struct registrar
+{
+  registrar(std::string name, fixture luapp, fixture raw);
+};
+
+// Number of global operator new calls since the start of the program.
+auto allocations() noexcept -> std::size_t;
+
+auto raw_state() -> std::shared_ptr<lua_State>;
+
+template <typename T> inline auto keep(const T& v) noexcept -> void
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "g"(&v) : "memory");
+#else
+  static const volatile void* sink;
+  sink = &v;
+#endif
+}
+
+} // namespace bench
+
+#endif // LUAPP_BENCH_BENCH_HPP_INCLUDED
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <bench.hpp>
+
+namespace
+{
+
+// counted from the worker threads of the state_pool benchmark as well.
+std::atomic<std::size_t> allocation_count = 0;
+
+struct options
+{
+  std::string filter;
+  std::string save;
+  std::string compare;
+  double threshold = 0.10;
+  double min_time = 0.05; // seconds per repetition
+  int repetitions = 5;
+};
+
+struct measurement
+{
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+struct result
+{
+  std::string name;
+  measurement luapp;
+  measurement raw;
+
+  auto ratio() const -> double { return luapp.ns_per_op / std::max(raw.ns_per_op, 1e-3); }
+};
+
+auto run_once(const bench::body& b, std::size_t n) -> double
+{
+  const auto start = std::chrono::steady_clock::now();
+  b(n);
+  const auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+auto measure(const bench::fixture& f, const options& opt) -> measurement
+{
+  const auto b = f();
+
+  // warm up and find how many operations fill a repetition.
+  std::size_t n = 1;
+  for (auto elapsed = run_once(b, n); elapsed < opt.min_time; elapsed = run_once(b, n)) {
+    const auto guess = elapsed > 0 ? opt.min_time / elapsed * 1.2 : 10.0;
+    n = static_cast<std::size_t>(n * std::clamp(guess, 1.5, 10.0)) + 1;
+  }
+
+  auto best = run_once(b, n);
+  for (int i = 1; i < opt.repetitions; ++i)
+    best = std::min(best, run_once(b, n));
+
+  const auto before = bench::allocations();
+  b(n);
+  const auto allocs = bench::allocations() - before;
+
+  return {best * 1e9 / n, static_cast<double>(allocs) / n};
+}
+
+auto parse(int argc, char** argv) -> options
+{
+  options opt;
+
+  const auto usage = [&] {
+    std::cerr << "usage: " << argv[0]
+              << " [--filter <substr>] [--save <file>] [--compare <file>]"
+                 " [--threshold <fraction>] [--min-time <seconds>] [--repetitions <n>]\n";
+    std::exit(2);
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    const auto arg = std::string{argv[i]};
+    if (i + 1 == argc)
+      usage();
+
+    const auto next = std::string{argv[++i]};
+    if (arg == "--filter")
+      opt.filter = next;
+    else if (arg == "--save")
+      opt.save = next;
+    else if (arg == "--compare")
+      opt.compare = next;
+    else if (arg == "--threshold")
+      opt.threshold = std::stod(next);
+    else if (arg == "--min-time")
+      opt.min_time = std::stod(next);
+    else if (arg == "--repetitions")
+      opt.repetitions = std::max(1, std::stoi(next));
+    else
+      usage();
+  }
+
+  return opt;
+}
+
+// Baseline format: one case per line, "name luapp_ns raw_ns ratio luapp_allocs".
+auto load_baseline(const std::string& filename) -> std::map<std::string, result>
+{
+  std::ifstream in(filename);
+  if (!in)
+    throw std::runtime_error{"cannot open baseline: " + filename};
+
+  std::map<std::string, result> baseline;
+  for (std::string line; std::getline(in, line);) {
+    if (line.empty() || line.front() == '#')
+      continue;
+
+    std::istringstream ss(line);
+    result r;
+    double ratio;
+    ss >> r.name >> r.luapp.ns_per_op >> r.raw.ns_per_op >> ratio >> r.luapp.allocs_per_op;
+    if (!ss)
+      throw std::runtime_error{"malformed baseline line: " + line};
+    baseline.insert_or_assign(r.name, r);
+  }
+
+  return baseline;
+}
+
+auto save_baseline(const std::string& filename, const std::vector<result>& results) -> void
+{
+  std::ofstream out(filename);
+  if (!out)
+    throw std::runtime_error{"cannot write baseline: " + filename};
+
+  out << "# name luapp_ns raw_ns ratio luapp_allocs\n";
+  for (const auto& r : results)
+    out << r.name << ' ' << r.luapp.ns_per_op << ' ' << r.raw.ns_per_op << ' ' << r.ratio() << ' '
+        << r.luapp.allocs_per_op << '\n';
+}
+
+// Ratios are compared instead of absolute times, so that a baseline recorded on one machine
+// remains meaningful on another.
+auto compare(const std::map<std::string, result>& baseline, const std::vector<result>& results,
+             double threshold) -> bool
+{
+  bool ok = true;
+  for (const auto& r : results) {
+    const auto it = baseline.find(r.name);
+    if (it == baseline.end()) {
+      std::printf("%-32s new case, not in baseline\n", r.name.c_str());
+      continue;
+    }
+
+    const auto& base = it->second;
+    const auto slower = r.ratio() > base.ratio() * (1.0 + threshold);
+    const auto allocs = r.luapp.allocs_per_op > base.luapp.allocs_per_op * (1.0 + threshold) + 0.01;
+
+    if (slower || allocs) {
+      ok = false;
+      std::printf("%-32s REGRESSION ratio %.2f -> %.2f, allocs/op %.2f -> %.2f\n", r.name.c_str(),
+                  base.ratio(), r.ratio(), base.luapp.allocs_per_op, r.luapp.allocs_per_op);
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (auto* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace bench
+{
+
+auto registry() -> std::vector<entry>&
+{
+  static std::vector<entry> entries;
+  return entries;
+}
+
+registrar::registrar(std::string name, fixture luapp, fixture raw)
+{
+  registry().push_back({std::move(name), std::move(luapp), std::move(raw)});
+}
+
+auto allocations() noexcept -> std::size_t
+{
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+auto raw_state() -> std::shared_ptr<lua_State>
+{
+  std::shared_ptr<lua_State> state(luaL_newstate(), lua_close);
+  if (!state)
+    throw std::bad_alloc{};
+  luaL_openlibs(state.get());
+  return state;
+}
+
+} // namespace bench
+
+int main(int argc, char** argv)
+{
+  try {
+    const auto opt = parse(argc, argv);
+
+    auto entries = bench::registry();
+    std::sort(entries.begin(), entries.end(),
+              [](const auto& a, const auto& b) { return a.name < b.name; });
+
+    std::printf("%-32s %12s %12s %8s %10s %10s\n", "case", "luapp ns/op", "raw ns/op", "ratio",
+                "allocs/op", "raw allocs");
+
+    std::vector<result> results;
+    for (const auto& e : entries) {
+      if (e.name.find(opt.filter) == std::string::npos)
+        continue;
+
+      result r{e.name, measure(e.luapp, opt), measure(e.raw, opt)};
+      std::printf("%-32s %12.1f %12.1f %8.2f %10.2f %10.2f\n", r.name.c_str(), r.luapp.ns_per_op,
+                  r.raw.ns_per_op, r.ratio(), r.luapp.allocs_per_op, r.raw.allocs_per_op);
+      std::fflush(stdout);
+      results.push_back(std::move(r));
+    }
+
+    if (!opt.save.empty())
+      save_baseline(opt.save, results);
+
+    if (!opt.compare.empty() && !compare(load_baseline(opt.compare), results, opt.threshold))
+      return 1;
+
+  } catch (const std::exception& e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return 2;
+  }
+
+  return 0;
+}
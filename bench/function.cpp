@@ -0,0 +1,137 @@
+#include <bench.hpp>
+
+namespace
+{
+
+using namespace lua;
+using detail::access;
+
+constexpr auto add_source = "return function(a, b) return a + b end";
+
+const bench::registrar call{
+  "function.call",
+  [] {
+    state s;
+    const function f = *static_cast<std::optional<function>>(s.do_string(add_source)[0]);
+    return [s, f](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(f.call(tuple{integer(i), integer{1}}));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    luaL_dostring(L.get(), add_source);
+    const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_pushinteger(state, i);
+        lua_pushinteger(state, 1);
+        lua_pcall(state, 2, 1, 0);
+        bench::keep(lua_tointeger(state, -1));
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+// The loop runs inside Lua, so that each operation is exactly one call into C++.
+constexpr auto loop_source = R"lua(
+  local f = f
+  return function(n)
+    for i = 1, n do f(i) end
+  end
+)lua";
+
+const bench::registrar closure{
+  "function.closure",
+  [] {
+    state s;
+    set(s.global_table(), "f", function(+[](value v) { return v; }));
+    const function loop = *static_cast<std::optional<function>>(s.do_string(loop_source)[0]);
+    return [s, loop](std::size_t n) { loop.call(tuple{integer(n)}); };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto state = L.get();
+    lua_pushcfunction(state, +[](lua_State* state) -> int {
+      lua_settop(state, 1);
+      return 1;
+    });
+    lua_setglobal(state, "f");
+    luaL_dostring(state, loop_source);
+    const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pushinteger(state, n);
+      lua_pcall(state, 1, 0, 0);
+    };
+  }};
+
+// Typed parameters are read straight from the stack, as a hand-written lua_CFunction would.
+constexpr auto add_loop_source = R"lua(
+  local add = add
+  return function(n)
+    local x = 0
+    for i = 1, n do x = add(x, i) end
+    return x
+  end
+)lua";
+
+const bench::registrar closure_typed{
+  "function.closure.typed",
+  [] {
+    state s;
+    set(s.global_table(), "add", function(+[](integer a, integer b) { return a + b; }));
+    const function loop = *static_cast<std::optional<function>>(s.do_string(add_loop_source)[0]);
+    return [s, loop](std::size_t n) { bench::keep(loop.call(tuple{integer(n)})); };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto state = L.get();
+    lua_pushcfunction(state, +[](lua_State* state) -> int {
+      lua_pushinteger(state, luaL_checkinteger(state, 1) + luaL_checkinteger(state, 2));
+      return 1;
+    });
+    lua_setglobal(state, "add");
+    luaL_dostring(state, add_loop_source);
+    const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pushinteger(state, n);
+      lua_pcall(state, 1, 1, 0);
+      bench::keep(lua_tointeger(state, -1));
+      lua_pop(state, 1);
+    };
+  }};
+
+const bench::registrar push{
+  "function.push",
+  [] {
+    state s;
+    const function f = +[](value v) { return v; };
+    return [s, f](std::size_t n) {
+      auto& sdata = access::data(s);
+      for (std::size_t i = 0; i < n; ++i) {
+        access::push(f, sdata);
+        lua_pop(sdata.state, 1);
+      }
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_pushcfunction(state, +[](lua_State* state) -> int {
+          lua_settop(state, 1);
+          return 1;
+        });
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+} // namespace
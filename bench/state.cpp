@@ -0,0 +1,130 @@
+#include <bench.hpp>
+#include <chrono>
+
+namespace
+{
+
+using namespace lua;
+
+constexpr auto source = "local a, b = 1, 2 return a + b";
+
+const bench::registrar do_string{
+  "state.do_string",
+  [] {
+    state s;
+    return [s](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(s.do_string(source));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        luaL_loadstring(state, source);
+        lua_pcall(state, 0, LUA_MULTRET, 0);
+        bench::keep(lua_tointeger(state, -1));
+        lua_settop(state, 0);
+      }
+    };
+  }};
+
+// A hand-written cache of compiled code is the raw counterpart of both cases below.
+auto raw_compiled() -> bench::body
+{
+  auto L = bench::raw_state();
+  luaL_loadstring(L.get(), source);
+  const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+  return [L, ref](std::size_t n) {
+    const auto state = L.get();
+    for (std::size_t i = 0; i < n; ++i) {
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pcall(state, 0, LUA_MULTRET, 0);
+      bench::keep(lua_tointeger(state, -1));
+      lua_settop(state, 0);
+    }
+  };
+}
+
+const bench::registrar do_string_cached{
+  "state.do_string.cached",
+  [] {
+    state s;
+    s.set_chunk_cache(16);
+    return [s](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(s.do_string(source));
+    };
+  },
+  raw_compiled};
+
+const bench::registrar chunk_call{
+  "state.chunk.call",
+  [] {
+    state s;
+    return [s, c = s.load(source)](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(c.call(tuple{}));
+    };
+  },
+  raw_compiled};
+
+// The same, recording its latency: a clock read on each side and a histogram update.
+const bench::registrar chunk_metrics{
+  "state.chunk.metrics",
+  [] {
+    state s;
+    s.metrics();
+    return [s, c = s.load(source, "bench")](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(c.call(tuple{}));
+    };
+  },
+  raw_compiled};
+
+constexpr auto loop = "local n = 0 for i = 1, 1000 do n = n + i end return n";
+
+auto raw_loop() -> bench::body
+{
+  auto L = bench::raw_state();
+  luaL_loadstring(L.get(), loop);
+  const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+  return [L, ref](std::size_t n) {
+    const auto state = L.get();
+    for (std::size_t i = 0; i < n; ++i) {
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pcall(state, 0, LUA_MULTRET, 0);
+      bench::keep(lua_tointeger(state, -1));
+      lua_settop(state, 0);
+    }
+  };
+}
+
+// A budget large enough never to run out: the cost of its hook against an unhooked call.
+const bench::registrar budget{
+  "state.budget",
+  [] {
+    state s;
+    s.set_budget({.instructions = 1'000'000'000, .time = std::chrono::seconds(10)});
+    return [s, c = s.load(loop)](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(c.call(tuple{}));
+    };
+  },
+  raw_loop};
+
+// One sample every 10000 instructions.
+const bench::registrar profiler{
+  "state.profiler",
+  [] {
+    state s;
+    s.start_profiler(10000);
+    return [s, c = s.load(loop)](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(c.call(tuple{}));
+    };
+  },
+  raw_loop};
+
+} // namespace
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <bench.hpp>
+#include <luapp/state_pool.hpp>
+
+namespace
+{
+
+using namespace lua;
+
+// A CPU-bound job, long enough for dispatch not to dominate.
+constexpr auto work = R"lua(
+  local x = 0
+  for i = 1, 20000 do x = x + i % 7 end
+  return x
+)lua";
+
+// Against a single raw state running the same jobs back to back, so the ratio is the inverse of
+// the speedup.
+const bench::registrar run{
+  "state_pool.run",
+  [] {
+    const auto workers = std::max(1u, std::thread::hardware_concurrency());
+    auto pool = std::make_shared<state_pool>(workers,
+                                             [](const state& s) { s.set_chunk_cache(16); });
+    return [pool](std::size_t n) {
+      std::vector<std::future<tuple>> results;
+      results.reserve(n);
+      for (std::size_t i = 0; i < n; ++i)
+        results.push_back(pool->run(work));
+      for (auto& r : results)
+        bench::keep(r.get());
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    luaL_loadstring(L.get(), work);
+    const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_pcall(state, 0, 1, 0);
+        bench::keep(lua_tointeger(state, -1));
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+} // namespace
@@ -0,0 +1,222 @@
+#include <bench.hpp>
+#include <luapp/pairs.hpp>
+#include <vector>
+
+namespace
+{
+
+using namespace lua;
+
+auto luapp_table() -> std::pair<state, table>
+{
+  state s;
+  auto t = s.create_table();
+  set(t, "x", integer{42});
+  return {s, t};
+}
+
+auto raw_table(lua_State* state) -> int
+{
+  lua_createtable(state, 0, 1);
+  lua_pushinteger(state, 42);
+  lua_setfield(state, -2, "x");
+  return luaL_ref(state, LUA_REGISTRYINDEX);
+}
+
+const bench::registrar get_integer{
+  "table.get.integer",
+  [] {
+    auto [s, t] = luapp_table();
+    return [s = s, t = t](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(get(t, "x").get_integer_or(0));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto ref = raw_table(L.get());
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_pushstring(state, "x");
+        lua_gettable(state, -2);
+        bench::keep(lua_tointeger(state, -1));
+        lua_pop(state, 2);
+      }
+    };
+  }};
+
+const bench::registrar get_key{
+  "table.get.key",
+  [] {
+    auto [s, t] = luapp_table();
+    return [s = s, t = t, k = s.create_key("x")](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(get(t, k).get_integer_or(0));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto ref = raw_table(L.get());
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_getfield(state, -1, "x");
+        bench::keep(lua_tointeger(state, -1));
+        lua_pop(state, 2);
+      }
+    };
+  }};
+
+const bench::registrar set_integer{
+  "table.set.integer",
+  [] {
+    auto [s, t] = luapp_table();
+    return [s = s, t = t](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        set(t, "x", integer(i));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto ref = raw_table(L.get());
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_pushstring(state, "x");
+        lua_pushinteger(state, i);
+        lua_settable(state, -3);
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+// One operation is a whole traversal of a table with 1000 entries.
+constexpr auto walk_source = R"lua(
+  local t = {}
+  for i = 1, 1000 do t[i] = i end
+  return t
+)lua";
+
+const bench::registrar walk_pairs{
+  "table.pairs.1000",
+  [] {
+    state s;
+    const auto t = *static_cast<std::optional<table>>(s.do_string(walk_source)[0]);
+    return [s, t](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        for (const auto& [k, v] : pairs(t))
+          bench::keep(v.get_integer_or(k.get_integer_or(0)));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    luaL_dostring(L.get(), walk_source);
+    const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_pushnil(state);
+        while (lua_next(state, -2)) {
+          bench::keep(lua_tointeger(state, -1));
+          lua_pop(state, 1);
+        }
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+const bench::registrar walk_ipairs{
+  "table.ipairs.1000",
+  [] {
+    state s;
+    const auto t = *static_cast<std::optional<table>>(s.do_string(walk_source)[0]);
+    return [s, t](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        for (const auto& [k, v] : ipairs(t))
+          bench::keep(v.get_integer_or(k));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    luaL_dostring(L.get(), walk_source);
+    const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        for (lua_Integer k = 1; lua_geti(state, -1, k) != LUA_TNIL; ++k) {
+          bench::keep(lua_tointeger(state, -1));
+          lua_pop(state, 1);
+        }
+        lua_pop(state, 2);
+      }
+    };
+  }};
+
+// One operation is a whole transfer of an array with 10000 elements.
+const bench::registrar create_from{
+  "table.create_from.10000",
+  [] {
+    state s;
+    return [s, xs = std::vector<double>(10000, 0.5)](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(s.create_table_from(xs));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    return [L, xs = std::vector<double>(10000, 0.5)](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_createtable(state, xs.size(), 0);
+        for (std::size_t j = 0; j < xs.size(); ++j) {
+          lua_pushnumber(state, xs[j]);
+          lua_rawseti(state, -2, j + 1);
+        }
+        const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+        luaL_unref(state, LUA_REGISTRYINDEX, ref);
+      }
+    };
+  }};
+
+const bench::registrar to_vector{
+  "table.to_vector.10000",
+  [] {
+    state s;
+    const auto t = s.create_table_from(std::vector<double>(10000, 0.5));
+    return [s, t](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(t.to_vector<double>());
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto state = L.get();
+    lua_createtable(state, 10000, 0);
+    for (int j = 1; j <= 10000; ++j) {
+      lua_pushnumber(state, 0.5);
+      lua_rawseti(state, -2, j);
+    }
+    const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        std::vector<double> xs(lua_rawlen(state, -1));
+        for (std::size_t j = 0; j < xs.size(); ++j) {
+          lua_rawgeti(state, -1, j + 1);
+          xs[j] = lua_tonumber(state, -1);
+          lua_pop(state, 1);
+        }
+        lua_pop(state, 1);
+        bench::keep(xs);
+      }
+    };
+  }};
+
+} // namespace
@@ -0,0 +1,77 @@
+#include <bench.hpp>
+#include <luapp/scheduler.hpp>
+#include <luapp/state.hpp>
+#include <luapp/task.hpp>
+#include <luapp/thread.hpp>
+#include <memory>
+
+namespace
+{
+
+using namespace lua;
+
+constexpr auto generator = "local i = 0 while true do i = i + 1 coroutine.yield(i) end";
+
+const bench::registrar resume{
+  "thread.resume",
+  [] {
+    state s;
+    const auto co = s.create_thread(s.load(generator));
+    return [s, co](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(co.resume());
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto co = lua_newthread(L.get());
+    luaL_ref(L.get(), LUA_REGISTRYINDEX); // anchors the thread
+    luaL_loadstring(co, generator);
+    return [L, co](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_resume(co, L.get(), 0);
+        bench::keep(lua_tointeger(co, -1));
+        lua_settop(co, 0);
+      }
+    };
+  }};
+
+constexpr auto caller = "local n = ... for i = 1, n do inc(i) end";
+
+// A script calling an async function whose result is ready at once: yield, await and resume.
+const bench::registrar async{
+  "thread.async",
+  [] {
+    state s;
+    auto sched = std::make_shared<scheduler>();
+    set(s.global_table(), "inc", sched->async([](integer i) -> task<integer> { co_return i + 1; }));
+    const auto loop = s.load(caller);
+    return [s, sched, loop](std::size_t n) {
+      const auto run = [&]() -> task<> {
+        co_await sched->resume(s.create_thread(loop), tuple{static_cast<integer>(n)});
+      };
+      sched->spawn(run());
+      sched->run();
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    lua_register(L.get(), "inc", [](lua_State* co) -> int {
+      return lua_yieldk(co, 1, 0, [](lua_State*, int, lua_KContext) -> int { return 1; });
+    });
+    return [L](std::size_t n) {
+      const auto co = lua_newthread(L.get());
+      luaL_loadstring(co, caller);
+      lua_pushinteger(co, static_cast<lua_Integer>(n));
+      auto nargs = 1;
+      while (lua_resume(co, L.get(), nargs) == LUA_YIELD) {
+        const auto i = lua_tointeger(co, -1);
+        lua_settop(co, 0);
+        lua_pushinteger(co, i + 1);
+        nargs = 1;
+      }
+      lua_pop(L.get(), 1);
+    };
+  }};
+
+} // namespace
@@ -0,0 +1,135 @@
+#include <new>
+
+#include <bench.hpp>
+
+namespace
+{
+
+using namespace lua;
+
+struct point
+{
+  double x, y;
+
+  auto norm() const -> double { return x * x + y * y; }
+};
+
+auto raw_create() -> bench::body
+{
+  auto L = bench::raw_state();
+  luaL_newmetatable(L.get(), "point");
+  lua_pop(L.get(), 1);
+  return [L](std::size_t n) {
+    const auto state = L.get();
+    for (std::size_t i = 0; i < n; ++i) {
+      new (lua_newuserdata(state, sizeof(point))) point{1.0, 2.0};
+      luaL_setmetatable(state, "point");
+      const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+      luaL_unref(state, LUA_REGISTRYINDEX, ref);
+    }
+  };
+}
+
+const bench::registrar create{
+  "userdata.create",
+  [] {
+    state s;
+    return [s](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(s.create_userdata(point{1.0, 2.0}));
+    };
+  },
+  raw_create};
+
+const bench::registrar emplace{
+  "userdata.emplace",
+  [] {
+    state s;
+    return [s](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(s.emplace_userdata<point>(1.0, 2.0));
+    };
+  },
+  raw_create};
+
+constexpr auto borrow_source =
+  "return function(p) local n = 0 for i = 1, p do n = n + norm(pt) end return n end";
+
+// A method taking its object by reference, called from Lua.
+const bench::registrar borrow{
+  "userdata.borrow",
+  [] {
+    state s;
+    const table g = s.global_table();
+    set(g, "norm", function([](const point& p) { return p.x * p.x + p.y * p.y; }));
+    set(g, "pt", s.emplace_userdata<point>(1.0, 2.0));
+    const function loop = *static_cast<std::optional<function>>(s.do_string(borrow_source)[0]);
+    return [s, loop](std::size_t n) { bench::keep(loop.call(tuple{integer(n)})); };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto state = L.get();
+    luaL_newmetatable(state, "point");
+    lua_pop(state, 1);
+    lua_pushcfunction(state, +[](lua_State* state) -> int {
+      const auto* p = static_cast<point*>(luaL_checkudata(state, 1, "point"));
+      lua_pushnumber(state, p->x * p->x + p->y * p->y);
+      return 1;
+    });
+    lua_setglobal(state, "norm");
+    new (lua_newuserdata(state, sizeof(point))) point{1.0, 2.0};
+    luaL_setmetatable(state, "point");
+    lua_setglobal(state, "pt");
+    luaL_dostring(state, borrow_source);
+    const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pushinteger(state, static_cast<lua_Integer>(n));
+      lua_pcall(state, 1, 1, 0);
+      bench::keep(lua_tonumber(state, -1));
+      lua_pop(state, 1);
+    };
+  }};
+
+constexpr auto method_source =
+  "return function(p) local n = 0 for i = 1, p do n = n + pt:norm() end return n end";
+
+// The same, as a method of a bound class.
+const bench::registrar method{
+  "userdata.method",
+  [] {
+    state s;
+    s.register_class<point>().method<&point::norm>("norm");
+    set(s.global_table(), "pt", s.emplace_userdata<point>(1.0, 2.0));
+    const function loop = *static_cast<std::optional<function>>(s.do_string(method_source)[0]);
+    return [s, loop](std::size_t n) { bench::keep(loop.call(tuple{integer(n)})); };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto state = L.get();
+    luaL_newmetatable(state, "point");
+    lua_newtable(state);
+    lua_pushcfunction(state, +[](lua_State* state) -> int {
+      lua_pushnumber(state, static_cast<point*>(luaL_checkudata(state, 1, "point"))->norm());
+      return 1;
+    });
+    lua_setfield(state, -2, "norm");
+    lua_setfield(state, -2, "__index");
+    lua_pop(state, 1);
+    new (lua_newuserdata(state, sizeof(point))) point{1.0, 2.0};
+    luaL_setmetatable(state, "point");
+    lua_setglobal(state, "pt");
+    luaL_dostring(state, method_source);
+    const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+      lua_pushinteger(state, static_cast<lua_Integer>(n));
+      lua_pcall(state, 1, 1, 0);
+      bench::keep(lua_tonumber(state, -1));
+      lua_pop(state, 1);
+    };
+  }};
+
+} // namespace
@@ -0,0 +1,228 @@
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <bench.hpp>
+
+namespace
+{
+
+using namespace lua;
+using detail::access;
+
+const bench::registrar push_integer{
+  "value.push.integer",
+  [] {
+    state s;
+    return [s](std::size_t n) {
+      auto& sdata = access::data(s);
+      const value v = integer{42};
+      for (std::size_t i = 0; i < n; ++i) {
+        access::push(v, sdata);
+        lua_pop(sdata.state, 1);
+      }
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_pushinteger(state, 42);
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+const bench::registrar push_string{
+  "value.push.string",
+  [] {
+    state s;
+    return [s](std::size_t n) {
+      auto& sdata = access::data(s);
+      const value v = "a moderately sized string value";
+      for (std::size_t i = 0; i < n; ++i) {
+        access::push(v, sdata);
+        lua_pop(sdata.state, 1);
+      }
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      const std::string v = "a moderately sized string value";
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_pushlstring(state, v.data(), v.size());
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+const bench::registrar push_table{
+  "value.push.table",
+  [] {
+    state s;
+    return [s, v = value{s.create_table()}](std::size_t n) {
+      auto& sdata = access::data(s);
+      for (std::size_t i = 0; i < n; ++i) {
+        access::push(v, sdata);
+        lua_pop(sdata.state, 1);
+      }
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    lua_newtable(L.get());
+    const auto ref = luaL_ref(L.get(), LUA_REGISTRYINDEX);
+    return [L, ref](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        lua_pop(state, 1);
+      }
+    };
+  }};
+
+// The value to be converted stays at the top of the stack during the whole run.
+struct pinned_state
+{
+  state s;
+  ~pinned_state() { lua_settop(access::data(s).state, 0); }
+};
+
+const bench::registrar at_integer{
+  "value.at.integer",
+  [] {
+    auto p = std::make_shared<pinned_state>();
+    lua_pushinteger(access::data(p->s).state, 42);
+    return [p](std::size_t n) {
+      auto& sdata = access::data(p->s);
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(access::at(sdata, -1));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    lua_pushinteger(L.get(), 42);
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(lua_tointeger(state, -1));
+    };
+  }};
+
+const bench::registrar at_string{
+  "value.at.string",
+  [] {
+    auto p = std::make_shared<pinned_state>();
+    lua_pushstring(access::data(p->s).state, "a moderately sized string value");
+    return [p](std::size_t n) {
+      auto& sdata = access::data(p->s);
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(access::at(sdata, -1));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    lua_pushstring(L.get(), "a moderately sized string value");
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        std::size_t len;
+        bench::keep(lua_tolstring(state, -1, &len));
+      }
+    };
+  }};
+
+const bench::registrar at_table{
+  "value.at.table",
+  [] {
+    auto p = std::make_shared<pinned_state>();
+    lua_newtable(access::data(p->s).state);
+    return [p](std::size_t n) {
+      auto& sdata = access::data(p->s);
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(access::at(sdata, -1));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    lua_newtable(L.get());
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        lua_pushvalue(state, -1);
+        const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+        luaL_unref(state, LUA_REGISTRYINDEX, ref);
+      }
+    };
+  }};
+
+struct point
+{
+  double x, y;
+};
+
+const bench::registrar at_userdata{
+  "value.at.userdata",
+  [] {
+    auto p = std::make_shared<pinned_state>();
+    access::push(value(p->s.emplace_userdata<point>(1.0, 2.0)), access::data(p->s));
+    return [p](std::size_t n) {
+      auto& sdata = access::data(p->s);
+      for (std::size_t i = 0; i < n; ++i)
+        bench::keep(access::at(sdata, -1));
+    };
+  },
+  [] {
+    auto L = bench::raw_state();
+    const auto state = L.get();
+    luaL_newmetatable(state, "point");
+    lua_pop(state, 1);
+    new (lua_newuserdata(state, sizeof(point))) point{1.0, 2.0};
+    luaL_setmetatable(state, "point");
+    return [L](std::size_t n) {
+      const auto state = L.get();
+      for (std::size_t i = 0; i < n; ++i) {
+        bench::keep(luaL_checkudata(state, -1, "point"));
+        lua_pushvalue(state, -1);
+        const auto ref = luaL_ref(state, LUA_REGISTRYINDEX);
+        luaL_unref(state, LUA_REGISTRYINDEX, ref);
+      }
+    };
+  }};
+
+// Handles are copied whenever values travel through tuples.
+const bench::registrar copy_tables{
+  "value.copy.table.x8",
+  [] {
+    state s;
+    std::vector<value> tables;
+    for (int i = 0; i < 8; ++i)
+      tables.emplace_back(s.create_table());
+    return [s, tables](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        auto copy = tables;
+        bench::keep(copy);
+      }
+    };
+  },
+  [] {
+    // the closest raw equivalent keeps the registry slots and copies their indices.
+    auto L = bench::raw_state();
+    std::vector<int> refs;
+    for (int i = 0; i < 8; ++i) {
+      lua_newtable(L.get());
+      refs.push_back(luaL_ref(L.get(), LUA_REGISTRYINDEX));
+    }
+    return [L, refs](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        auto copy = refs;
+        bench::keep(copy);
+      }
+    };
+  }};
+
+} // namespace
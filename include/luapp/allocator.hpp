@@ -0,0 +1,79 @@
+#ifndef LUAPP_ALLOCATOR_HPP_INCLUDED
+#define LUAPP_ALLOCATOR_HPP_INCLUDED
+
+#include <cstddef>
+
+namespace lua
+{
+
+// Memory policy of a Lua state, following the `lua_Alloc` protocol: allocates when `ptr` is
+// null (then `osize` is zero), frees when `nsize` is zero and reallocates otherwise.  `osize` is
+// always the size previously requested for `ptr`.  Returning null on failure lets Lua raise a
+// memory error.  Blocks must be aligned for any fundamental type.
+//
+// A state calls its allocator only from the thread currently running it.
+class allocator
+{
+public:
+  virtual ~allocator() = default;
+
+  virtual auto reallocate(void* ptr, std::size_t osize, std::size_t nsize) noexcept -> void* = 0;
+};
+
+// `std::realloc` and `std::free`, as `luaL_newstate`.
+class default_allocator final : public allocator
+{
+public:
+  auto reallocate(void*, std::size_t, std::size_t) noexcept -> void* override;
+};
+
+// Free lists of small blocks, segregated by size class and cached per thread, so that the
+// strings, tables and closures Lua keeps churning never reach malloc nor contend on its locks.
+// Larger blocks go to `std::realloc`.
+//
+// Pooled memory is never returned to the system; the free blocks of a thread go to a global
+// depot when the thread exits, or when it caches more than a slab's worth of one size, from where
+// other threads take them.  A single instance may be shared by any number of states.
+class pool_allocator final : public allocator
+{
+public:
+  static constexpr std::size_t granularity = 16;
+  static constexpr std::size_t max_pooled = 256;
+
+  auto reallocate(void*, std::size_t, std::size_t) noexcept -> void* override;
+};
+
+// Monotonic arena for short-lived states that are discarded whole: allocation is a pointer bump,
+// frees are ignored (except for the most recent block) and everything is released at once when
+// the arena is destroyed.  Memory freed by the garbage collector is not reused, so it does not
+// suit long-running states.  Not thread-safe: use one arena per state.
+class arena_allocator final : public allocator
+{
+public:
+  explicit arena_allocator(std::size_t block_size = 64 * 1024) noexcept;
+  ~arena_allocator() noexcept override;
+
+  arena_allocator(const arena_allocator&) = delete;
+  auto operator=(const arena_allocator&) -> arena_allocator& = delete;
+
+  auto reallocate(void*, std::size_t, std::size_t) noexcept -> void* override;
+
+  // total bytes obtained from the system.
+  auto reserved() const noexcept -> std::size_t;
+
+private:
+  struct block;
+
+  auto bump(std::size_t) noexcept -> std::byte*;
+
+  std::size_t block_size_;
+  std::size_t reserved_ = 0;
+  block* blocks_ = nullptr;
+  std::byte* cursor_ = nullptr;
+  std::byte* limit_ = nullptr;
+  std::byte* last_ = nullptr; // most recent allocation, can grow or shrink in place
+};
+
+} // namespace lua
+
+#endif // LUAPP_ALLOCATOR_HPP_INCLUDED
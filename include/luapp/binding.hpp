@@ -0,0 +1,361 @@
+#ifndef LUAPP_BINDING_HPP_INCLUDED
+#define LUAPP_BINDING_HPP_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <luapp/function.hpp>
+#include <luapp/stats.hpp>
+#include <luapp/table.hpp>
+#include <luapp/tuple.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+class scheduler;
+struct state_data;
+
+namespace detail
+{
+
+auto state_of(lua_State* state) noexcept -> state_data&;
+
+template <typename> constexpr bool is_std_tuple_v = false;
+template <typename... T> constexpr bool is_std_tuple_v<std::tuple<T...>> = true;
+template <typename T, typename U> constexpr bool is_std_tuple_v<std::pair<T, U>> = true;
+
+template <typename T>
+constexpr bool is_scalar_result_v = std::is_arithmetic_v<T> || std::is_same_v<T, std::string> ||
+                                    std::is_same_v<T, std::string_view> ||
+                                    std::is_same_v<T, const char*>;
+
+// Classes the library does not convert, held by userdata when they cross into Lua.  Callables
+// are objects too, but are returned as functions unless wrapped in `as_object`.
+template <typename T>
+constexpr bool is_object_v = std::is_class_v<T> && !std::is_constructible_v<T, value> &&
+                             (!std::is_constructible_v<value, T> || bindable<T>) &&
+                             !is_std_tuple_v<T> && !std::is_same_v<T, std::string> &&
+                             !std::is_same_v<T, std::string_view>;
+
+template <typename T> struct as_object
+{
+  T object;
+};
+
+template <typename> constexpr bool is_as_object_v = false;
+template <typename T> constexpr bool is_as_object_v<as_object<T>> = true;
+
+// Result of a method returning its object by reference: the receiver, argument 1, is returned.
+struct self_result
+{};
+
+template <typename A>
+constexpr bool borrows_v = std::is_lvalue_reference_v<A> && is_object_v<std::remove_cvref_t<A>>;
+
+// Trampolines for typed C++ callables: arguments are read from the stack and results pushed
+// onto it directly, without building any `tuple` or `value` for scalars.
+struct binding
+{
+  friend class lua::scheduler;
+
+  template <typename F, typename R, typename... Args> static auto make(F f) -> function::native
+  {
+    auto target = std::make_shared<F>(std::move(f));
+    auto generic = std::make_shared<std::function<tuple(tuple)>>([target](tuple t) -> tuple {
+      return call<F, R, Args...>(*target, t, std::index_sequence_for<Args...>{});
+    });
+    return {&trampoline<F, R, Args...>, std::move(target), std::move(generic)};
+  }
+
+  template <typename F, typename R, typename... Args>
+  static auto make(F f, std::type_identity<std::tuple<Args...>>) -> function::native
+  {
+    return make<F, R, Args...>(std::move(f));
+  }
+
+  template <typename F, typename R, typename... Args>
+  static auto trampoline(lua_State* state) -> int
+  {
+    // Lua errors must not be raised while C++ objects are alive, so exceptions are caught, the
+    // frame is unwound and only then the error is raised.
+    char message[256];
+    try {
+      auto& sdata = state_of(state);
+      const auto* target =
+        static_cast<std::shared_ptr<void>*>(lua_touserdata(state, lua_upvalueindex(1)));
+      auto& f = *static_cast<F*>(target->get());
+      return invoke<F, R, Args...>(f, sdata, state, std::index_sequence_for<Args...>{});
+    } catch (const std::exception& e) {
+      copy_message(message, sizeof(message), e.what());
+    } catch (...) {
+      copy_message(message, sizeof(message), "unknown C++ exception");
+    }
+
+    lua_pushstring(state, message);
+    return lua_error(state);
+  }
+
+  // The Lua-facing part of functions built from `std::function<tuple(tuple)>`.
+  static auto generic_trampoline(lua_State* state) -> int;
+
+  template <typename T> static auto read(state_data& sdata, lua_State* state, int index) -> T
+  {
+    if constexpr (std::is_same_v<T, value>) {
+      return value::at(sdata, state, index);
+    } else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, boolean>) {
+      return lua_toboolean(state, index) != 0;
+    } else if constexpr (std::is_integral_v<T>) {
+      int isnum;
+      const auto x = lua_tointegerx(state, index, &isnum);
+      if (!isnum || !std::in_range<T>(x))
+        throw bad_argument(state, index, "integer");
+      return static_cast<T>(x);
+    } else if constexpr (std::is_floating_point_v<T>) {
+      int isnum;
+      const auto x = lua_tonumberx(state, index, &isnum);
+      if (!isnum)
+        throw bad_argument(state, index, "number");
+      return static_cast<T>(x);
+    } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+      if (!lua_isstring(state, index))
+        throw bad_argument(state, index, "string");
+      std::size_t size;
+      const auto* p = lua_tolstring(state, index, &size);
+      if constexpr (std::is_same_v<T, std::string>) {
+        LUAPP_STAT(count_string(sdata, size));
+      }
+      return T(p, size);
+    } else if constexpr (std::is_pointer_v<T>) {
+      using U = std::remove_cv_t<std::remove_pointer_t<T>>;
+      if (const auto* h = userdata::header_at(state, index); h && h->tag == &type_tag<U>)
+        return userdata::object_of<U>(*h);
+      return nullptr;
+    } else if constexpr (std::is_same_v<T, std::optional<integer>>) {
+      if (lua_isinteger(state, index))
+        return lua_tointeger(state, index);
+      return std::nullopt;
+    } else if constexpr (std::is_same_v<T, std::optional<floating>>) {
+      if (lua_type(state, index) == LUA_TNUMBER)
+        return lua_tonumber(state, index);
+      return std::nullopt;
+    } else if constexpr (std::is_same_v<T, std::optional<boolean>>) {
+      if (lua_type(state, index) == LUA_TBOOLEAN)
+        return boolean{lua_toboolean(state, index) != 0};
+      return std::nullopt;
+    } else if constexpr (std::is_same_v<T, std::optional<std::string_view>>) {
+      if (lua_type(state, index) != LUA_TSTRING)
+        return std::nullopt;
+      std::size_t size;
+      const auto* p = lua_tolstring(state, index, &size);
+      return std::string_view(p, size);
+    } else {
+      return static_cast<T>(value::at(sdata, state, index));
+    }
+  }
+
+  // The same conversions, for calls from C++.
+  template <typename T> static auto read(const value& v, int index) -> T
+  {
+    if constexpr (std::is_same_v<T, value>) {
+      return v;
+    } else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, boolean>) {
+      return static_cast<bool>(v);
+    } else if constexpr (std::is_integral_v<T>) {
+      if (const std::optional<integer> x = v; x && std::in_range<T>(*x))
+        return static_cast<T>(*x);
+      if (const std::optional<floating> x = v; x && std::in_range<T>(static_cast<integer>(*x)) &&
+                                              static_cast<floating>(static_cast<integer>(*x)) == *x)
+        return static_cast<T>(*x);
+      throw std::runtime_error{"bad argument #" + std::to_string(index) + " (integer expected)"};
+    } else if constexpr (std::is_floating_point_v<T>) {
+      if (const std::optional<floating> x = v)
+        return static_cast<T>(*x);
+      throw std::runtime_error{"bad argument #" + std::to_string(index) + " (number expected)"};
+    } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+      if (const std::optional<std::string_view> x = v)
+        return T(*x);
+      throw std::runtime_error{"bad argument #" + std::to_string(index) + " (string expected)"};
+    } else if constexpr (std::is_pointer_v<T>) {
+      if (const std::optional<userdata> u = v)
+        return u->get<std::remove_cv_t<std::remove_pointer_t<T>>>(); // kept alive by `v`
+      return nullptr;
+    } else {
+      return static_cast<T>(v);
+    }
+  }
+
+  // Parameters declared as lvalue references to objects, such as `point&`, borrow the object of
+  // a userdata for the duration of the call.  Others get a copy.
+  template <typename A> static auto argument(state_data& sdata, lua_State* state, int index)
+    -> decltype(auto)
+  {
+    using T = std::remove_cvref_t<A>;
+    if constexpr (borrows_v<A>) {
+      if (auto* p = read<T*>(sdata, state, index))
+        return static_cast<A>(*p);
+      throw bad_argument(state, index, "matching userdata");
+    } else {
+      return read<T>(sdata, state, index);
+    }
+  }
+
+  template <typename A> static auto argument(const value& v, int index) -> decltype(auto)
+  {
+    using T = std::remove_cvref_t<A>;
+    if constexpr (borrows_v<A>) {
+      if (auto* p = read<T*>(v, index))
+        return static_cast<A>(*p);
+      throw std::runtime_error{"bad argument #" + std::to_string(index) +
+                               " (matching userdata expected)"};
+    } else {
+      return read<T>(v, index);
+    }
+  }
+
+  // Pushes a result and returns how many values it took.
+  template <typename T> static auto push(state_data& sdata, lua_State* state, T&& x) -> int
+  {
+    using U = std::remove_cvref_t<T>;
+
+    if constexpr (std::is_same_v<U, tuple>) {
+      if (!check_stack(state, static_cast<int>(x.size())))
+        throw std::bad_alloc{};
+      for (std::size_t i = 0; i < x.size(); ++i)
+        x[i].push(sdata, state);
+      return static_cast<int>(x.size());
+    } else if constexpr (is_std_tuple_v<U>) {
+      int n = 0;
+      std::apply([&](auto&&... xs) { ((n += push(sdata, state, xs)), ...); }, x);
+      return n;
+    } else {
+      if (!check_stack(state, 1))
+        throw std::bad_alloc{};
+
+      if constexpr (std::is_same_v<U, boolean>)
+        lua_pushboolean(state, static_cast<bool>(x));
+      else if constexpr (is_scalar_result_v<U>)
+        push_element(state, x);
+      else if constexpr (std::is_same_v<U, self_result>)
+        lua_pushvalue(state, 1);
+      else if constexpr (is_as_object_v<U>)
+        userdata::push_inline<decltype(x.object)>(sdata, state, std::forward<T>(x).object);
+      else if constexpr (is_object_v<U> && !std::is_constructible_v<value, U>)
+        userdata::push_inline<U>(sdata, state, std::forward<T>(x));
+      else
+        value(std::forward<T>(x)).push(sdata, state);
+      return 1;
+    }
+  }
+
+  template <typename T> static auto to_value(T&& x) -> value
+  {
+    using U = std::remove_cvref_t<T>;
+
+    if constexpr (std::is_same_v<U, bool>)
+      return boolean{x};
+    else if constexpr (std::is_integral_v<U>)
+      return static_cast<integer>(x);
+    else if constexpr (std::is_floating_point_v<U>)
+      return static_cast<floating>(x);
+    else if constexpr (std::is_same_v<U, std::string_view>)
+      return string(x);
+    else if constexpr (is_as_object_v<U> || std::is_same_v<U, self_result> ||
+                       (is_object_v<U> && !std::is_constructible_v<value, U>))
+      throw std::runtime_error{"functions returning objects can only be called from Lua"};
+    else
+      return value(std::forward<T>(x));
+  }
+
+private:
+  template <typename F, typename R, typename... Args, std::size_t... I>
+  static auto invoke(F& f, state_data& sdata, lua_State* state, std::index_sequence<I...>) -> int
+  {
+    if constexpr (std::is_void_v<R>) {
+      f(argument<Args>(sdata, state, static_cast<int>(I) + 1)...);
+      return 0;
+    } else {
+      return push(sdata, state,
+                  f(argument<Args>(sdata, state, static_cast<int>(I) + 1)...));
+    }
+  }
+
+  template <typename F, typename R, typename... Args, std::size_t... I>
+  static auto call(F& f, const tuple& t, std::index_sequence<I...>) -> tuple
+  {
+    if constexpr (std::is_void_v<R>) {
+      f(argument<Args>(t.at(I), static_cast<int>(I) + 1)...);
+      return tuple{};
+    } else {
+      auto r = f(argument<Args>(t.at(I), static_cast<int>(I) + 1)...);
+      if constexpr (std::is_same_v<decltype(r), tuple>)
+        return r;
+      else if constexpr (is_std_tuple_v<decltype(r)>)
+        return std::apply([](auto&&... xs) { return tuple{to_value(xs)...}; }, std::move(r));
+      else
+        return tuple{to_value(std::move(r))};
+    }
+  }
+
+  static auto bad_argument(lua_State*, int index, const char* expected) -> std::runtime_error;
+
+  static auto copy_message(char* out, std::size_t size, const char* message) noexcept -> void
+  {
+    std::strncpy(out, message, size - 1);
+    out[size - 1] = '\0';
+  }
+};
+
+} // namespace detail
+
+template <std::size_t N, typename F>
+function::function(std::integral_constant<std::size_t, N>, F f)
+  : function(std::function<tuple(tuple)>([f = std::move(f)](tuple t) -> tuple {
+      return t.apply(std::integral_constant<std::size_t, N>{}, f);
+    }))
+{
+  using R = decltype(std::apply(std::declval<F>(), std::declval<std::array<value, N>>()));
+  static_assert(std::is_constructible_v<tuple, R> || std::is_same_v<void, R>);
+}
+
+template <typename... Args> auto function::operator()(Args&&... args) -> tuple
+{
+  return call(tuple{std::forward<Args>(args)...});
+}
+
+template <std::size_t N, typename... Args>
+auto function::operator()(std::integral_constant<std::size_t, N> ret, Args&&... args)
+  -> std::array<value, N>
+{
+  return call(tuple{std::forward<Args>(args)...}).expand(ret);
+}
+
+template <typename R, typename... Args>
+function::function(R (*f)(Args...)) : f_(detail::binding::make<R (*)(Args...), R, Args...>(f))
+{}
+
+template <detail::bindable F>
+function::function(F f)
+  : f_(detail::binding::make<F, typename detail::call_signature<decltype(&F::operator())>::result>(
+      std::move(f),
+      std::type_identity<typename detail::call_signature<decltype(&F::operator())>::arguments>{}))
+{}
+
+} // namespace lua
+
+#endif // LUAPP_BINDING_HPP_INCLUDED
@@ -0,0 +1,42 @@
+#ifndef LUAPP_CHUNK_HPP_INCLUDED
+#define LUAPP_CHUNK_HPP_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <luapp/function.hpp>
+#include <luapp/reference.hpp>
+
+namespace lua
+{
+
+// A compiled piece of Lua code, ready to be called any number of times without going through
+// the compiler again.
+class chunk : public function
+{
+  friend class state;
+
+public:
+  chunk(const chunk&) = default;
+  chunk(chunk&&) noexcept = default;
+
+  auto operator=(const chunk&) -> chunk& = default;
+  auto operator=(chunk&&) noexcept -> chunk& = default;
+
+  auto name() const noexcept -> const std::string&;
+
+  // Precompiled bytecode, to be loaded later with `state::load_binary` or `state::load_file`.
+  // Stripping removes debug information (line numbers, local names) from the dump.
+  auto dump(bool strip = false) const -> std::vector<std::byte>;
+
+private:
+  chunk(reference, std::string, std::shared_ptr<histogram> latency) noexcept;
+
+  std::string name_;
+};
+
+} // namespace lua
+
+#endif // LUAPP_CHUNK_HPP_INCLUDED
@@ -0,0 +1,159 @@
+#ifndef LUAPP_CLASS_BUILDER_HPP_INCLUDED
+#define LUAPP_CLASS_BUILDER_HPP_INCLUDED
+
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include <luapp/function.hpp>
+#include <luapp/state.hpp>
+#include <luapp/table.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+// Binds the methods of `T`, started by `state::register_class`:
+//
+//   const table vec = s.register_class<vector>()
+//                       .constructor<double, double>()
+//                       .method<&vector::norm>("norm")
+//                       .method<&vector::scale>("scale")
+//                       .methods();
+//   set(s.global_table(), "vector", vec);
+//
+// after which scripts write `vector.new(3, 4):norm()`.  Each method is a trampoline of its own
+// that borrows `self` from the userdata and reads its other arguments from the stack.
+template <typename T> class class_builder
+{
+  friend class state;
+
+public:
+  // Adds `new`, which takes `Args` and returns a `T` held inline by a userdata.
+  template <typename... Args> auto constructor() -> class_builder&
+  {
+    set(methods_, "new", function([](Args... args) {
+          return detail::as_object<T>{T(std::forward<Args>(args)...)};
+        }));
+    return *this;
+  }
+
+  // Adds a member function, called as `object:name(...)`, or a function pointer.  Member
+  // functions returning a `T&` return their object, so that calls chain on the same userdata.
+  template <auto M> auto method(const char* name) -> class_builder&
+  {
+    set(methods_, name, bind<M>());
+    return *this;
+  }
+
+  // The `__index` of the objects, where methods and the constructor are.
+  auto methods() const -> const table& { return methods_; }
+
+private:
+  class_builder(table metatable, table methods)
+    : metatable_(std::move(metatable)), methods_(std::move(methods))
+  {}
+
+  template <auto M> static auto bind() -> function
+  {
+    using signature = detail::call_signature<decltype(M)>;
+    using arguments = typename signature::arguments;
+    if constexpr (std::is_member_function_pointer_v<decltype(M)>) {
+      using self = std::tuple<typename signature::object&>;
+      return bind<M, typename signature::result>(
+        std::type_identity<decltype(std::tuple_cat(std::declval<self>(),
+                                                   std::declval<arguments>()))>{});
+    } else {
+      return bind<M, typename signature::result>(std::type_identity<arguments>{});
+    }
+  }
+
+  template <auto M, typename R, typename... Params>
+  static auto bind(std::type_identity<std::tuple<Params...>>) -> function
+  {
+    return function([](Params... params) {
+      if constexpr (std::is_void_v<R>) {
+        std::invoke(M, std::forward<Params>(params)...);
+      } else if constexpr (returns_self<M, R>) {
+        std::invoke(M, std::forward<Params>(params)...);
+        return detail::self_result{};
+      } else {
+        return result(std::invoke(M, std::forward<Params>(params)...));
+      }
+    });
+  }
+
+  template <auto M, typename R>
+  static constexpr bool returns_self = std::is_member_function_pointer_v<decltype(M)> &&
+                                       std::is_lvalue_reference_v<R> &&
+                                       std::is_same_v<std::remove_cvref_t<R>, T>;
+
+  // results of type `T` are new objects, copied or moved, even if it is callable.
+  template <typename R> static auto result(R&& r)
+  {
+    if constexpr (std::is_same_v<std::remove_cvref_t<R>, T>)
+      return detail::as_object<T>{std::forward<R>(r)};
+    else
+      return std::forward<R>(r);
+  }
+
+  // The metamethods of the operators `T` defines.
+  auto bind_operators() -> void
+  {
+    const auto& mt = metatable_;
+
+    if constexpr (requires(const T& a, const T& b) { a + b; })
+      set(mt, "__add", function([](const T& a, const T& b) { return result(a + b); }));
+    if constexpr (requires(const T& a, const T& b) { a - b; })
+      set(mt, "__sub", function([](const T& a, const T& b) { return result(a - b); }));
+    if constexpr (requires(const T& a, const T& b) { a * b; })
+      set(mt, "__mul", function([](const T& a, const T& b) { return result(a * b); }));
+    if constexpr (requires(const T& a, const T& b) { a / b; })
+      set(mt, "__div", function([](const T& a, const T& b) { return result(a / b); }));
+    if constexpr (requires(const T& a) { -a; })
+      set(mt, "__unm", function([](const T& a) { return result(-a); }));
+
+    // Lua compares any two userdata with the metamethod of either.
+    if constexpr (requires(const T& a, const T& b) { a == b; })
+      set(mt, "__eq", function([](const T* a, const T* b) { return a && b && *a == *b; }));
+    if constexpr (requires(const T& a, const T& b) { a < b; })
+      set(mt, "__lt", function([](const T& a, const T& b) -> bool { return a < b; }));
+    if constexpr (requires(const T& a, const T& b) { a <= b; })
+      set(mt, "__le", function([](const T& a, const T& b) -> bool { return a <= b; }));
+
+    if constexpr (requires(const T& a) { a.size(); })
+      set(mt, "__len", function([](const T& a) { return a.size(); }));
+    if constexpr (requires { &T::operator(); })
+      set(mt, "__call", bind<&T::operator()>());
+    if constexpr (requires(std::ostream& out, const T& a) { out << a; })
+      set(mt, "__tostring", function([](const T& a) {
+            std::ostringstream out;
+            out << a;
+            return out.str();
+          }));
+  }
+
+  table metatable_;
+  table methods_;
+};
+
+template <typename T> auto state::register_class() const -> class_builder<T>
+{
+  static_assert(detail::is_object_v<T>);
+
+  table methods = create_table();
+  register_metatable(typeid(T), {{"__index", methods}});
+
+  class_builder<T> builder(detail::metatable_of(*data_, typeid(T)), std::move(methods));
+  builder.bind_operators();
+  return builder;
+}
+
+} // namespace lua
+
+#endif // LUAPP_CLASS_BUILDER_HPP_INCLUDED
@@ -1,8 +1,10 @@
 #ifndef LUAPP_FUNCTION_HPP_INCLUDED
 #define LUAPP_FUNCTION_HPP_INCLUDED
 
+#include <array>
 #include <functional>
 #include <memory>
+#include <tuple>
 #include <type_traits>
 #include <variant>
 
@@ -11,37 +13,88 @@ extern "C" {
 }
 
 #include <luapp/reference.hpp>
-#include <luapp/tuple.hpp>
 
 namespace lua
 {
 
 struct state_data;
+class histogram;
+class tuple;
+class value;
+
+namespace detail
+{
+struct access;
+struct binding;
+
+// Signature of a function pointer or of the call operator of a lambda or function object.
+template <typename> struct call_signature;
+
+template <typename C, typename R, typename... Args> struct call_signature<R (C::*)(Args...)>
+{
+  using object = C;
+  using result = R;
+  using arguments = std::tuple<Args...>;
+};
+
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...) const> : call_signature<R (C::*)(Args...)>
+{
+  using object = const C;
+};
+
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...) noexcept> : call_signature<R (C::*)(Args...)>
+{};
+
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...) const noexcept> : call_signature<R (C::*)(Args...)>
+{
+  using object = const C;
+};
+
+template <typename R, typename... Args> struct call_signature<R (*)(Args...)>
+{
+  using result = R;
+  using arguments = std::tuple<Args...>;
+};
+
+// Signature of a function pointer or function object.
+template <typename F> struct signature_of : call_signature<decltype(&F::operator())>
+{};
+
+template <typename R, typename... Args>
+struct signature_of<R (*)(Args...)> : call_signature<R (*)(Args...)>
+{};
+
+// Callables with a single, non-template call operator that do not already take a `tuple`.
+template <typename F>
+concept bindable = std::is_class_v<F> && requires { &F::operator(); } &&
+                   !std::is_convertible_v<F, std::function<tuple(tuple)>>;
+} // namespace detail
 
 class function
 {
+  friend class chunk;
+  friend class state;
   friend class value;
+  friend struct detail::access;
+  friend struct detail::binding;
+  friend class scheduler;
 
 public:
   function(std::function<tuple(tuple)>) noexcept;
 
-  template <typename R, typename... Args>
-  function(R (*f)(Args...))
-    : function(std::function<tuple(tuple)>([f](tuple t) -> tuple { return t.apply(f); }))
-  {
-    static_assert(std::is_constructible_v<tuple, R> || std::is_same_v<void, R>);
-    static_assert((std::is_convertible_v<value, Args> && ...));
-  }
-
-  template <std::size_t N, typename F>
-  function(std::integral_constant<std::size_t, N>, F f)
-    : function(std::function<tuple(tuple)>([f = std::move(f)](tuple t) -> tuple {
-        return t.apply(std::integral_constant<std::size_t, N>{}, f);
-      }))
-  {
-    using R = decltype(std::apply(std::declval<F>(), std::declval<std::array<value, N>>()));
-    static_assert(std::is_constructible_v<tuple, R> || std::is_same_v<void, R>);
-  }
+  // Functions and lambdas with typed parameters get a dedicated trampoline, which reads the
+  // arguments straight from the Lua stack and pushes the results directly.  Parameters may be
+  // `value`, arithmetic types, `bool`, `std::string`, `std::string_view` (valid during the call),
+  // pointers to userdata payloads (null if the argument is not a userdata of that type), or
+  // anything a `value` converts to.  Results may be `void`, any of those, `tuple` or a
+  // `std::tuple` of them.  Arguments that cannot be read raise a Lua error, as do exceptions.
+  template <typename R, typename... Args> function(R (*f)(Args...));
+  template <detail::bindable F> function(F f);
+
+  template <std::size_t N, typename F> function(std::integral_constant<std::size_t, N>, F f);
 
   function(const function&) = default;
   function(function&&) noexcept = default;
@@ -51,17 +104,12 @@ public:
 
   auto call(tuple) const -> tuple;
 
-  template <typename... Args> auto operator()(Args&&... args) -> tuple
-  {
-    return call(tuple{std::forward<Args>(args)...});
-  }
+  // The templates of this class are defined in <luapp/binding.hpp>, once `tuple` is complete.
+  template <typename... Args> auto operator()(Args&&... args) -> tuple;
 
   template <std::size_t N, typename... Args>
   auto operator()(std::integral_constant<std::size_t, N> ret, Args&&... args)
-    -> std::array<value, N>
-  {
-    return call(tuple{std::forward<Args>(args)...}).expand(ret);
-  }
+    -> std::array<value, N>;
 
   // because of the complexity of dealing with closures and stuff, they are always
   // different from each other.  This behavior might change in future versions.
@@ -69,12 +117,28 @@ public:
   auto operator!=(const function&) const -> bool;
 
 private:
-  function(reference) noexcept;
+  // A C++ callable with a dedicated `lua_CFunction`.
+  struct native
+  {
+    lua_CFunction trampoline;
+    std::shared_ptr<void> target;                           // upvalue of the trampoline
+    std::shared_ptr<std::function<tuple(tuple)>> generic; // for calls from C++
+  };
+
+  // A Lua function; loaded chunks carry the histogram of their calls once metrics are on.
+  struct script
+  {
+    reference ref;
+    std::shared_ptr<histogram> latency;
+  };
+
+  function(reference, std::shared_ptr<histogram> latency = nullptr) noexcept;
+  function(native) noexcept;
 
-  auto push(std::shared_ptr<state_data>) const -> int;
-  auto push(std::shared_ptr<state_data>, lua_State*) const -> int;
+  auto push(state_data&) const -> int;
+  auto push(state_data&, lua_State*) const -> int;
 
-  std::variant<std::shared_ptr<std::function<tuple(tuple)>>, reference> f_;
+  std::variant<std::shared_ptr<std::function<tuple(tuple)>>, script, native> f_;
 };
 
 } // namespace lua
@@ -0,0 +1,46 @@
+#ifndef LUAPP_KEY_HPP_INCLUDED
+#define LUAPP_KEY_HPP_INCLUDED
+
+#include <memory>
+#include <string_view>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <luapp/reference.hpp>
+
+namespace lua
+{
+
+struct state_data;
+
+// A field name interned once by `state::create_key` and anchored in the registry.  Indexing a
+// table with it pushes the existing Lua string instead of building, hashing and interning the
+// name again on every access.  A key can only index tables of the state that created it.
+class key
+{
+  friend class state;
+  friend class table;
+
+public:
+  key(const key&) noexcept = default;
+  key(key&&) noexcept = default;
+
+  auto operator=(const key&) noexcept -> key& = default;
+  auto operator=(key&&) noexcept -> key& = default;
+
+  auto name() const noexcept -> std::string_view;
+
+private:
+  key(reference, std::string_view) noexcept;
+
+  auto push(lua_State*) const -> void;
+
+  reference ref_;
+  std::string_view name_; // the contents of the anchored Lua string
+};
+
+} // namespace lua
+
+#endif // LUAPP_KEY_HPP_INCLUDED
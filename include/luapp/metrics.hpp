@@ -0,0 +1,127 @@
+#ifndef LUAPP_METRICS_HPP_INCLUDED
+#define LUAPP_METRICS_HPP_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <luapp/function.hpp>
+
+namespace lua
+{
+
+// Latencies in nanoseconds, in log-linear buckets as HDR histograms: exact below 32ns, and
+// within 1/32 of the value above.  Recording is lock-free and may run concurrently with readers.
+class histogram
+{
+public:
+  static constexpr unsigned sub_bits = 5;
+  static constexpr unsigned max_bits = 40; // larger values, over 18 minutes, are clamped
+
+  auto record(std::uint64_t ns) noexcept -> void;
+
+  auto count() const noexcept -> std::uint64_t;
+  auto sum() const noexcept -> std::uint64_t;
+
+  // Smallest recorded value that is not exceeded by a fraction `q` of the others, rounded up to
+  // its bucket; zero if empty.
+  auto quantile(double q) const noexcept -> std::uint64_t;
+
+private:
+  static constexpr std::size_t sub_buckets = std::size_t{1} << sub_bits;
+  static constexpr std::size_t buckets = (max_bits - sub_bits + 1) * sub_buckets;
+
+  static auto index_of(std::uint64_t) noexcept -> std::size_t;
+  static auto highest_of(std::size_t index) noexcept -> std::uint64_t;
+
+  std::array<std::atomic<std::uint64_t>, buckets> counts_{};
+  std::atomic<std::uint64_t> count_ = 0;
+  std::atomic<std::uint64_t> sum_ = 0;
+};
+
+namespace detail
+{
+// Records the time until its destruction, unless given no histogram.
+class latency_timer
+{
+public:
+  explicit latency_timer(histogram* h) noexcept
+    : h_(h), start_(h ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{})
+  {}
+
+  ~latency_timer()
+  {
+    if (!h_)
+      return;
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    h_->record(static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+  }
+
+  latency_timer(const latency_timer&) = delete;
+  auto operator=(const latency_timer&) -> latency_timer& = delete;
+
+private:
+  histogram* h_;
+  std::chrono::steady_clock::time_point start_;
+};
+} // namespace detail
+
+// Latency histograms of the named chunks a state runs and of the C++ functions bound with
+// `timed`.  Names are added by the state's thread; everything may be read from any other.
+class metrics
+{
+public:
+  // Histogram of a chunk, by the name it was loaded with.
+  auto chunk_latency(std::string_view name) -> std::shared_ptr<histogram>;
+
+  // Histogram of a C++ function, by the name given to `timed`.
+  auto function_latency(std::string_view name) -> std::shared_ptr<histogram>;
+
+  // Wraps a C++ callable so that the latency of each of its calls is recorded under `name`.  The
+  // result has the same signature, and can be bound as a `function` in the same way.
+  template <typename F> auto timed(std::string_view name, F f)
+  {
+    using signature = detail::signature_of<F>;
+    return timed<typename signature::result>(
+      function_latency(name), std::move(f),
+      std::type_identity<typename signature::arguments>{});
+  }
+
+  // Counts, sums and the 0.5, 0.99 and 0.999 quantiles of every histogram, in seconds, in the
+  // Prometheus text exposition format.
+  auto prometheus() const -> std::string;
+
+private:
+  using registry = std::map<std::string, std::shared_ptr<histogram>, std::less<>>;
+
+  auto find(registry&, std::string_view name) -> std::shared_ptr<histogram>;
+
+  template <typename R, typename F, typename... Args>
+  static auto timed(std::shared_ptr<histogram> h, F f, std::type_identity<std::tuple<Args...>>)
+  {
+    return [h = std::move(h), f = std::move(f)](Args... args) mutable -> R {
+      const detail::latency_timer timer(h.get());
+      return f(std::forward<Args>(args)...);
+    };
+  }
+
+  mutable std::mutex mutex_;
+  registry chunks_;
+  registry functions_;
+};
+
+} // namespace lua
+
+#endif // LUAPP_METRICS_HPP_INCLUDED
@@ -0,0 +1,119 @@
+#ifndef LUAPP_PAIRS_HPP_INCLUDED
+#define LUAPP_PAIRS_HPP_INCLUDED
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <luapp/table.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+struct state_data;
+
+// Single-pass range over all entries of a table, in the order of `lua_next`.
+//
+// The table and the current key stay on the Lua stack while the range is alive, so ranges must
+// be destroyed in the reverse order of their creation (as they naturally are in nested loops).
+// Entries are converted to values only when the iterator is dereferenced.  As in Lua, assigning
+// to new fields during the traversal is undefined; existing fields may be modified or cleared.
+class pairs
+{
+public:
+  class iterator
+  {
+    friend class pairs;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<value, value>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    auto operator*() const -> value_type;
+    auto operator++() -> iterator&;
+
+    auto operator==(const iterator& other) const noexcept -> bool { return range_ == other.range_; }
+    auto operator!=(const iterator& other) const noexcept -> bool { return range_ != other.range_; }
+
+  private:
+    explicit iterator(pairs*) noexcept;
+
+    pairs* range_;
+  };
+
+  explicit pairs(const table&);
+  ~pairs() noexcept;
+
+  pairs(const pairs&) = delete;
+  auto operator=(const pairs&) -> pairs& = delete;
+
+  auto begin() -> iterator;
+  auto end() noexcept -> iterator;
+
+private:
+  auto next() -> bool;
+
+  state_data* sdata_;
+  lua_State* state_;
+  int base_;
+};
+
+// Single-pass range over t[1], t[2], ... up to the first nil, as Lua's `ipairs`.
+//
+// Same stack discipline as `pairs`.  Elements are read with `lua_geti`, thus respecting `__index`.
+class ipairs
+{
+public:
+  class iterator
+  {
+    friend class ipairs;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<integer, value>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    auto operator*() const -> value_type;
+    auto operator++() -> iterator&;
+
+    auto operator==(const iterator& other) const noexcept -> bool { return range_ == other.range_; }
+    auto operator!=(const iterator& other) const noexcept -> bool { return range_ != other.range_; }
+
+  private:
+    explicit iterator(ipairs*) noexcept;
+
+    ipairs* range_;
+  };
+
+  explicit ipairs(const table&);
+  ~ipairs() noexcept;
+
+  ipairs(const ipairs&) = delete;
+  auto operator=(const ipairs&) -> ipairs& = delete;
+
+  auto begin() -> iterator;
+  auto end() noexcept -> iterator;
+
+private:
+  auto next() -> bool;
+
+  state_data* sdata_;
+  lua_State* state_;
+  int base_;
+  integer index_ = 0;
+};
+
+} // namespace lua
+
+#endif // LUAPP_PAIRS_HPP_INCLUDED
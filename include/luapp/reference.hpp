@@ -1,7 +1,9 @@
 #ifndef LUAPP_REFERENCE_HPP_INCLUDED
 #define LUAPP_REFERENCE_HPP_INCLUDED
 
-#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <thread>
 
 extern "C" {
 #include <lua.h>
@@ -11,42 +13,89 @@ namespace lua
 {
 
 struct state_data;
+struct reference_data;
+struct release_node;
+
+// Outlives its state for as long as references to the state's objects exist, so that they can
+// tell whether the state is still open.  Owned by the state and by each `reference_data`.
+//
+// Handles are copied and released without atomics on the thread that created the state, which
+// must be the one running it.  Other threads may drop handles at any time: each release is queued
+// onto `released`, a lock-free stack that the owner drains in batches.
+struct state_token
+{
+  std::atomic<state_data*> sdata; // null once the state is closed
+  std::atomic<std::size_t> count;
+  std::thread::id owner;
+  reference_data* dead;                // released by the owner, to unref at the next safe point
+  std::atomic<release_node*> released; // by other threads; the closed marker once closed
+};
 
+// A registry slot shared by copies of a reference.  Once the state is closed, the count is only
+// updated atomically, since any thread may then hold the last copy.
 struct reference_data
 {
-  std::weak_ptr<state_data> sdata;
+  state_token* token;
   int index;
+  std::size_t count;
+  reference_data* next; // in `state_token::dead`
+};
+
+// A handle released on another thread than the owner's.
+struct release_node
+{
+  reference_data* data;
+  release_node* next;
 };
 
 class reference
 {
+  friend class chunk;
   friend class table;
   friend class value;
   friend class state;
   friend class userdata;
   friend class function;
+  friend class key;
+  friend class pairs;
+  friend class ipairs;
+  friend class thread;
 
 public:
   reference() noexcept = default;
+  ~reference() noexcept;
 
-  reference(const reference&) noexcept = default;
-  reference(reference&) noexcept = default;
+  reference(const reference&) noexcept;
+  reference(reference&) noexcept;
+  reference(reference&&) noexcept;
 
-  auto operator=(const reference&) noexcept -> reference& = default;
-  auto operator=(reference&) noexcept -> reference& = default;
+  auto operator=(const reference&) noexcept -> reference&;
+  auto operator=(reference&) noexcept -> reference&;
+  auto operator=(reference&&) noexcept -> reference&;
 
   auto valid() const noexcept -> bool;
   operator bool() const noexcept;
 
 private:
-  reference(std::shared_ptr<state_data>, int);
+  // takes ownership of the registry slot `index`.
+  reference(state_data&, int index);
+
+  auto push(state_data&) const -> int;
+  auto push(state_data&, lua_State*) const -> int;
+
+  // null if the state was closed.
+  auto state() const noexcept -> state_data*;
+
+  auto release() noexcept -> void;
 
-  auto push(std::shared_ptr<state_data>) const -> int;
-  auto push(std::shared_ptr<state_data>, lua_State* state) const -> int;
+  // Unrefs the slots released so far.  Only from the owner of the (open) state.
+  static auto collect(state_data&) noexcept -> void;
 
-  auto state() const -> std::shared_ptr<state_data>;
+  // Marks the token as closed, applies the pending releases and gives up the state's ownership.
+  // From the owner.
+  static auto close(state_token*) noexcept -> void;
 
-  std::shared_ptr<reference_data> data_;
+  reference_data* data_ = nullptr;
 };
 
 } // namespace lua
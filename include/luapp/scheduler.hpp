@@ -0,0 +1,236 @@
+#ifndef LUAPP_SCHEDULER_HPP_INCLUDED
+#define LUAPP_SCHEDULER_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <luapp/binding.hpp>
+#include <luapp/function.hpp>
+#include <luapp/task.hpp>
+#include <luapp/thread.hpp>
+#include <luapp/tuple.hpp>
+
+namespace lua
+{
+
+// Runs many tasks cooperatively on the calling thread, typically one per script session, each
+// driving its own Lua coroutine of the same state:
+//
+//   sched.spawn([](scheduler& sched, thread co) -> task<> {
+//     while (co.get_status() == thread::status::suspended)
+//       handle(co_await sched.resume(co));
+//   }(sched, s.create_thread(session)));
+//   sched.run();
+//
+// Scripts call functions bound with `async` as any other, while their coroutine waits for the
+// result and the other tasks run.
+//
+// A scheduler and the tasks it runs must only be used by one thread at a time, except for `post`.
+class scheduler
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  class yield_awaiter
+  {
+  public:
+    auto await_ready() const noexcept -> bool { return false; }
+    auto await_suspend(std::coroutine_handle<> h) -> void { sched_->ready_.push_back(h); }
+    auto await_resume() const noexcept -> void {}
+
+  private:
+    friend class scheduler;
+
+    explicit yield_awaiter(scheduler& sched) noexcept : sched_(&sched) {}
+
+    scheduler* sched_;
+  };
+
+  class sleep_awaiter
+  {
+  public:
+    auto await_ready() const noexcept -> bool { return false; }
+    auto await_suspend(std::coroutine_handle<> h) -> void { sched_->timers_.push({deadline_, h}); }
+    auto await_resume() const noexcept -> void {}
+
+  private:
+    friend class scheduler;
+
+    sleep_awaiter(scheduler& sched, clock::time_point deadline) noexcept
+      : sched_(&sched), deadline_(deadline)
+    {}
+
+    scheduler* sched_;
+    clock::time_point deadline_;
+  };
+
+  scheduler() = default;
+
+  // Destroys the tasks that have not finished.
+  ~scheduler() noexcept;
+
+  scheduler(const scheduler&) = delete;
+  auto operator=(const scheduler&) -> scheduler& = delete;
+
+  // The task starts at the next `run` or `poll`.
+  auto spawn(task<void>) -> void;
+
+  // Runs until every task has finished, sleeping while they all wait for timers or posts.  The
+  // first exception that escapes a task is rethrown once nothing is left to run.
+  auto run() -> void;
+
+  // Runs the tasks that are ready, without waiting for the others.
+  auto poll() -> void;
+
+  // Number of spawned tasks that have not finished.
+  auto size() const noexcept -> std::size_t;
+
+  // Lets the other ready tasks run first, then resumes `co` as `thread::resume` and returns
+  // what it yields or returns.  Calls to `async` functions are awaited in between.
+  auto resume(thread co, tuple args) -> task<tuple>;
+  auto resume(thread co) -> task<tuple>;
+
+  // Lets the other ready tasks run first.
+  auto yield() noexcept -> yield_awaiter;
+
+  auto sleep_for(clock::duration) noexcept -> sleep_awaiter;
+  auto sleep_until(clock::time_point) noexcept -> sleep_awaiter;
+
+  // Makes a suspended coroutine ready; for awaitables completed by the scheduler's thread.
+  auto schedule(std::coroutine_handle<>) -> void;
+
+  // The same, from any thread, waking up `run`.
+  auto post(std::coroutine_handle<>) -> void;
+
+  // Binds a callable returning a `task` as a Lua function that suspends its calling coroutine
+  // until the task finishes, then returns its results or raises its exception as an error.  It
+  // can only be called from coroutines resumed by this scheduler, which must outlive it.
+  template <typename F> auto async(F f) -> function
+  {
+    using signature = detail::signature_of<F>;
+    using arguments = typename signature::arguments;
+    return async<F, typename signature::result>(std::move(f), std::type_identity<arguments>{});
+  }
+
+private:
+  struct root;
+
+  struct timer
+  {
+    clock::time_point deadline;
+    std::coroutine_handle<> h;
+
+    auto operator>(const timer& other) const noexcept -> bool { return deadline > other.deadline; }
+  };
+
+  template <typename F> struct async_target
+  {
+    scheduler* sched;
+    F f;
+  };
+
+  template <typename F, typename R, typename... Args>
+  auto async(F f, std::type_identity<std::tuple<Args...>>) -> function
+  {
+    auto target = std::make_shared<async_target<F>>(async_target<F>{this, std::move(f)});
+    auto generic = std::make_shared<std::function<tuple(tuple)>>([](tuple) -> tuple {
+      throw std::runtime_error{"async functions can only be called from Lua"};
+    });
+    return function(
+      function::native{&start<F, R, Args...>, std::move(target), std::move(generic)});
+  }
+
+  // Starts the task and yields; `finish` continues the call once the task is done.
+  template <typename F, typename R, typename... Args> static auto start(lua_State* state) -> int
+  {
+    char message[256];
+    try {
+      auto& sdata = detail::state_of(state);
+      const auto* target =
+        static_cast<std::shared_ptr<void>*>(lua_touserdata(state, lua_upvalueindex(1)));
+      auto& [sched, f] = *static_cast<async_target<F>*>(target->get());
+
+      if (state != sched->driving_ || !lua_isyieldable(state))
+        throw std::runtime_error{
+          "async functions must be called from a coroutine resumed by their scheduler"};
+
+      sched->pending_.emplace(results(invoke<F, R, Args...>(f, sdata, state,
+                                                            std::index_sequence_for<Args...>{})));
+      message[0] = '\0';
+    } catch (const std::exception& e) {
+      detail::binding::copy_message(message, sizeof(message), e.what());
+    } catch (...) {
+      detail::binding::copy_message(message, sizeof(message), "unknown C++ exception");
+    }
+
+    // the arguments stay below the values given to the resume, so their count is the context.
+    if (message[0] == '\0')
+      return lua_yieldk(state, 0, lua_gettop(state), &finish);
+
+    lua_pushstring(state, message);
+    return lua_error(state);
+  }
+
+  static auto finish(lua_State*, int status, lua_KContext nargs) -> int;
+
+  template <typename F, typename R, typename... Args, std::size_t... I>
+  static auto invoke(F& f, [[maybe_unused]] state_data& sdata, [[maybe_unused]] lua_State* state,
+                     std::index_sequence<I...>) -> R
+  {
+    return f(detail::binding::argument<Args>(sdata, state, static_cast<int>(I) + 1)...);
+  }
+
+  template <typename T> static auto results(task<T> t) -> task<tuple>
+  {
+    if constexpr (std::is_void_v<T>) {
+      co_await std::move(t);
+      co_return tuple{};
+    } else {
+      auto r = co_await std::move(t);
+      if constexpr (std::is_same_v<T, tuple>)
+        co_return r;
+      else if constexpr (detail::is_std_tuple_v<T>)
+        co_return std::apply([](auto&&... xs) { return tuple{detail::binding::to_value(xs)...}; },
+                             std::move(r));
+      else
+        co_return tuple{detail::binding::to_value(std::move(r))};
+    }
+  }
+
+  auto run_ready() -> void;
+  auto wake_up(bool wait) -> void;
+
+  std::deque<std::coroutine_handle<>> ready_;
+  std::list<std::coroutine_handle<>> roots_; // spawned tasks, each wrapped in a `root`
+  std::priority_queue<timer, std::vector<timer>, std::greater<>> timers_;
+  std::exception_ptr error_;
+
+  lua_State* driving_ = nullptr;       // the coroutine being resumed
+  std::optional<task<tuple>> pending_; // started by an async function it called
+
+  std::mutex posted_mutex_;
+  std::condition_variable posted_cv_;
+  std::vector<std::coroutine_handle<>> posted_;
+};
+
+} // namespace lua
+
+#endif // LUAPP_SCHEDULER_HPP_INCLUDED
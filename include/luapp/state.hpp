@@ -1,8 +1,19 @@
 #ifndef LUAPP_STATE_HPP_INCLUDED
 #define LUAPP_STATE_HPP_INCLUDED
 
+#include <chrono>
+#include <climits>
+#include <cstddef>
 #include <initializer_list>
+#include <list>
 #include <memory>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <type_traits>
 #include <typeindex>
 #include <unordered_map>
@@ -12,32 +23,168 @@ extern "C" {
 #include <lua.h>
 }
 
+#include <luapp/allocator.hpp>
+#include <luapp/chunk.hpp>
+#include <luapp/key.hpp>
+#include <luapp/metrics.hpp>
 #include <luapp/reference.hpp>
+#include <luapp/stats.hpp>
 #include <luapp/table.hpp>
+#include <luapp/thread.hpp>
 #include <luapp/tuple.hpp>
 #include <luapp/userdata.hpp>
+#include <luapp/value.hpp>
 
 namespace lua
 {
 
+// Least recently used compiled chunks of `do_string`, keyed by a hash of the source.
+struct chunk_cache
+{
+  struct entry
+  {
+    std::size_t hash; // of both the source and the name
+    std::string source;
+    std::optional<std::string> name; // null when named by the source, as Lua does
+    reference ref;
+    std::shared_ptr<histogram> latency; // of named chunks, once metrics are on
+  };
+
+  std::size_t capacity = 0; // disabled
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+
+  std::list<entry> entries; // most recently used first
+  std::unordered_map<std::size_t, std::list<entry>::iterator> index;
+};
+
+struct chunk_cache_stats
+{
+  std::size_t hits;
+  std::size_t misses;
+  std::size_t size;
+  std::size_t capacity;
+};
+
+// Bytes allocated on behalf of a state, as seen by its `lua_Alloc`.
+struct memory_account
+{
+  std::size_t usage = 0;
+  std::size_t peak = 0;
+  std::size_t limit = 0; // unlimited
+  unsigned protected_calls = 0; // the limit is only enforced inside them
+  bool refused = false;         // by the limit, since the outermost of them started
+  bool track_cpp = false;
+
+  auto charge(std::size_t n) noexcept -> void
+  {
+    usage += n;
+    if (usage > peak)
+      peak = usage;
+  }
+
+  auto credit(std::size_t n) noexcept -> void { usage -= n; }
+};
+
+// Work allowed to each call into Lua from C++, as `do_string`, `function::call` or
+// `thread::resume`.  Calls nested in another share its budget.  Zero means unlimited.
+struct budget
+{
+  std::size_t instructions = 0;
+  std::chrono::steady_clock::duration time{};
+};
+
+// Thrown by calls that run out of their budget.
+class budget_exceeded : public std::runtime_error
+{
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// The budget of the running call, checked by a count hook installed only while it runs.
+struct budget_account
+{
+  lua::budget limit;
+  bool active = false; // a budgeted call is running
+  bool exceeded = false;
+  int step = 0;         // instructions between checks
+  std::size_t used = 0; // instructions, counted in steps
+  std::chrono::steady_clock::time_point deadline;
+};
+
+// Stacks sampled by the profiler, with the number of times each was seen.
+struct profiler_account
+{
+  bool active = false;
+  int interval = 0;  // instructions between samples
+  int countdown = 0; // instructions before the next sample
+  std::unordered_map<std::string, std::size_t> stacks;
+};
+
 struct state_data
 {
   lua_State* state;
   std::unordered_map<std::type_index, table> metatables;
+  chunk_cache chunks;
+  std::shared_ptr<allocator> alloc; // null if Lua's default
+  memory_account memory;
+  budget_account budget;
+  profiler_account profiler;
+  std::shared_ptr<lua::metrics> metrics; // null until asked for
+  state_token* token;
+  int functions; // registry index of the closures of C++ functions, weak-valued
+#ifdef LUAPP_STATS
+  state_stats stats;
+#endif
 };
 
 class userdata;
+template <typename T> class class_builder;
+
+namespace detail
+{
+struct access;
+
+// Calls the function below its `nargs` arguments at the top of the stack, as `lua_pcall` with
+// `LUA_MULTRET`.  Errors are thrown: `std::bad_alloc` for memory errors (including the memory
+// limit of the state) and `std::runtime_error` with the error message otherwise.
+auto pcall(state_data&, int nargs) -> void;
+
+// Bracket every call into Lua from C++, on the main thread or on a coroutine, so that the memory
+// limit and the budget apply to it.
+auto enter(state_data&, lua_State* state) noexcept -> void;
+auto leave(state_data&, lua_State* state) noexcept -> void;
+
+// Whether an ordinary error is really a memory error: `luaL_Buffer`, used by `string.rep`,
+// `table.concat` and others, reports the allocations refused by the limit that way.
+auto is_memory_error(const state_data&, int status, const char* message) noexcept -> bool;
+
+// Whether the value at `index` is a C++ function pushed by the library.
+auto is_cpp_function(lua_State* state, int index) -> bool;
+
+// The data of the state running `state` (or any of its threads).
+auto state_of(lua_State* state) noexcept -> state_data&;
+
+// The metatable registered for a type, or the default one.
+auto metatable_of(state_data&, std::type_index) -> const table&;
+} // namespace detail
 
 class state
 {
   friend class userdata;
+  friend struct detail::access;
 
 public:
   enum options : unsigned {
     std_libs = 1,
+    track_cpp_memory = 2, // attributes the library's own allocations to the state
   };
 
   explicit state(options = std_libs);
+
+  // All memory of the Lua state goes through the given allocator, which is kept alive until the
+  // state is closed.
+  explicit state(std::shared_ptr<allocator>, options = std_libs);
   ~state() noexcept = default;
 
   state(const state&) noexcept = default;
@@ -48,7 +195,73 @@ public:
 
   auto global_table() const -> table;
 
-  auto do_string(const char*) const -> tuple;
+  // Runs Lua source.  The chunk name appears in error messages, defaults to the source itself
+  // and, once `metrics` has been asked for, labels the latency of the call.
+  auto do_string(const char* code, const char* chunkname = nullptr) const -> tuple;
+
+  // Compiles (but does not run) Lua source.  The chunk name appears in error messages and
+  // defaults to the first line of the source, shortened as Lua does: `[string "..."]`.
+  auto load(const char* code, const char* chunkname = nullptr) const -> chunk;
+
+  // Loads bytecode produced by `chunk::dump`.  Lua does not verify bytecode, so only load
+  // binaries from trusted sources.
+  auto load_binary(std::span<const std::byte>, const char* chunkname = "=binary") const -> chunk;
+
+  // Loads either source or bytecode from a file, detected by its signature.
+  auto load_file(const char* filename) const -> chunk;
+
+  // Keeps up to `capacity` chunks compiled by `do_string`, so that running the same source again
+  // skips the compiler.  Zero (the default) disables and clears the cache.
+  auto set_chunk_cache(std::size_t capacity) const -> void;
+  auto chunk_cache_stats() const noexcept -> lua::chunk_cache_stats;
+
+  // Handles are copied on the thread that created the state, but may be dropped on any thread;
+  // the registry slots of the last ones are only freed at safe points on the owner: when
+  // `do_string` or a Lua function is called, when a new reference is created, or here.
+  auto collect_refs() const noexcept -> void;
+
+  // Bytes currently allocated by the Lua state and, with `track_cpp_memory`, by the references
+  // and userdata payloads the library creates for it.
+  auto memory_usage() const noexcept -> std::size_t;
+
+  // Highest memory usage since the state was created or since the last reset.
+  auto memory_peak() const noexcept -> std::size_t;
+  auto reset_memory_peak() const noexcept -> void;
+
+  // Allocations that would take the memory usage beyond `limit` fail, after a full garbage
+  // collection, with a memory error that `do_string`, `function::call` and `thread::resume` throw
+  // as `std::bad_alloc`; so are the errors the standard library raises for them, such as the
+  // "not enough memory for buffer allocation" of `string.rep`.  The limit only applies while Lua
+  // code runs: allocations made directly by the C++ API may overshoot it, since Lua cannot report
+  // their failure.  Zero (the default) disables the limit.
+  auto set_memory_limit(std::size_t limit) const noexcept -> void;
+  auto memory_limit() const noexcept -> std::size_t;
+
+  // Stops each call into Lua that runs for more than the given number of VM instructions or
+  // time: it fails with `budget_exceeded`, even if the script catches the error, or, when it
+  // runs in a coroutine, yields no values.  Time spent in C functions is only checked when they
+  // return.  An empty budget (the default) disables the check, which then costs nothing.
+  auto set_budget(lua::budget) const noexcept -> void;
+  auto budget() const noexcept -> lua::budget;
+
+  // Latencies of the calls to named chunks, as `do_string` with a chunk name or `function::call`
+  // of a chunk loaded from now on.  The returned object lives as long as the state, and may be
+  // shared with other threads to be rendered.
+  auto metrics() const -> std::shared_ptr<lua::metrics>;
+
+  // Counters of internal operations, for diagnostics; all zero unless the library is built with
+  // the `LUAPP_STATS` option.
+  auto stats() const noexcept -> state_stats;
+
+  // Samples the stack of the running Lua code every `interval` VM instructions, until stopped.
+  // Starting again discards the previous samples.  C++ functions appear as frames while they
+  // call back into Lua; time spent in C code alone is not sampled.
+  auto start_profiler(std::size_t interval = 10000) const -> void;
+  auto stop_profiler() const noexcept -> void;
+
+  // The samples, one line per stack from the outermost frame, followed by its count: the folded
+  // format read by flame graph tools.
+  auto folded_profile() const -> std::string;
 
   template <std::size_t N>
   auto do_string(std::integral_constant<std::size_t, N> nrets, const char* code) const
@@ -58,18 +271,54 @@ public:
 
   auto create_table() const -> table;
 
+  // Interns `name` once, for repeated indexing with `get` and `set`.
+  auto create_key(std::string_view name) const -> key;
+
+  // A new coroutine that runs `f` when first resumed.
+  auto create_thread(const function& f) const -> thread;
+
+  // Creates the array {values[0], ..., values[n - 1]}, presized and filled with raw sets.
+  template <typename T> auto create_table_from(std::span<const T> values) const -> table
+  {
+    static_assert(detail::is_pushable_element_v<T>, "unsupported element type");
+
+    if (values.size() > static_cast<std::size_t>(INT_MAX))
+      throw std::length_error{"array too large"};
+
+    const auto state = data_->state;
+    if (!detail::check_stack(state, 2))
+      throw std::bad_alloc{};
+
+    lua_createtable(state, static_cast<int>(values.size()), 0);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      detail::push_element(state, values[i]);
+      lua_rawseti(state, -2, static_cast<lua_Integer>(i + 1));
+    }
+
+    return pop_table();
+  }
+
+  template <std::ranges::contiguous_range R> auto create_table_from(const R& values) const -> table
+  {
+    using T = std::ranges::range_value_t<R>;
+    return create_table_from(
+      std::span<const T>(std::ranges::data(values), std::ranges::size(values)));
+  }
+
   template <typename T> auto create_userdata(std::shared_ptr<T> ptr) const
   {
     static_assert(std::is_same_v<T, std::decay_t<T>>);
     static_assert(!std::is_same_v<T, void>);
-    return userdata(*this, typeid(T), std::move(ptr));
+    userdata::push_shared(*data_, data_->state, std::move(ptr), 0);
+    return userdata::pop(*data_);
   }
 
   template <typename T> auto create_userdata(T value) const
   {
     static_assert(std::is_same_v<T, std::decay_t<T>>);
     static_assert(!std::is_same_v<T, void>);
-    return userdata(*this, typeid(T), std::make_shared<T>(std::move(value)));
+    userdata::push_shared(*data_, data_->state, std::make_shared<T>(std::move(value)), sizeof(T));
+    return userdata::pop(*data_);
   }
 
   template <typename T, typename... Args>
@@ -77,18 +326,53 @@ public:
   {
     static_assert(std::is_same_v<T, std::decay_t<T>>);
     static_assert(!std::is_same_v<T, void>);
-    return userdata(*this, typeid(T), std::make_shared<T>(std::forward<Args>(args)...));
+    userdata::push_shared(*data_, data_->state, std::make_shared<T>(std::forward<Args>(args)...),
+                          sizeof(T));
+    return userdata::pop(*data_);
+  }
+
+  // Constructs the object inside the Lua userdata itself: a single allocation, counted by the
+  // state as any other, and no reference counting.  It is destroyed when Lua collects the
+  // userdata, or when the state is closed.  Bound functions may take it as `T&` or `T*`, and C++
+  // borrows it with `userdata::get`.
+  template <typename T, typename... Args> auto emplace_userdata(Args&&... args) const
+  {
+    static_assert(std::is_same_v<T, std::decay_t<T>>);
+    static_assert(!std::is_same_v<T, void>);
+    userdata::push_inline<T>(*data_, data_->state, std::forward<Args>(args)...);
+    return userdata::pop(*data_);
   }
 
   auto register_metatable(std::type_index, std::initializer_list<std::pair<value, value>>) const
     -> void;
 
+  // Registers the metatable of `T`, with the metamethods of the operators it defines, and returns
+  // a builder for its methods.  See `class_builder`.
+  template <typename T> auto register_class() const -> class_builder<T>;
+
 private:
-  auto get_metatable(std::type_index) const -> const table&;
+
+  // anchors the table at the top of the stack and pops it.
+  auto pop_table() const -> table;
+
+  // pushes the compiled code, possibly from the chunk cache, or an error message.  `latency` is
+  // set to the histogram of named chunks once metrics are on, resolved once per cache entry.
+  auto push_chunk(const char* code, const char* chunkname,
+                  std::shared_ptr<histogram>& latency) const -> int;
+
+  // anchors the result of a `luaL_load*` call or throws its error.
+  auto pop_chunk(int status, std::string name) const -> chunk;
 
   std::shared_ptr<state_data> data_;
 };
 
+constexpr auto operator|(state::options lhs, state::options rhs) noexcept -> state::options
+{
+  return static_cast<state::options>(static_cast<unsigned>(lhs) | static_cast<unsigned>(rhs));
+}
+
 } // namespace lua
 
+#include <luapp/class_builder.hpp>
+
 #endif // LUAPP_STATE_HPP_INCLUDED
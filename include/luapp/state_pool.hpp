@@ -0,0 +1,95 @@
+#ifndef LUAPP_STATE_POOL_HPP_INCLUDED
+#define LUAPP_STATE_POOL_HPP_INCLUDED
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <luapp/state.hpp>
+#include <luapp/tuple.hpp>
+
+namespace lua
+{
+
+// Runs jobs on a fixed set of states, each owned by one worker thread: a state is created, set
+// up, used and closed only by its worker.  Idle workers steal queued jobs from the others.
+//
+// Nothing that belongs to a pooled state may leave its job: results of `run` and `call` are
+// copied out as plain values (nil, booleans, numbers and strings) and fail otherwise, and so must
+// their arguments.  Jobs given to `submit` must follow the same rule.
+class state_pool
+{
+public:
+  using setup_function = std::function<void(const state&)>;
+
+  // Invoked on the worker thread, with either the results or the exception thrown by the job.
+  // It must not throw.
+  using completion = std::function<void(std::exception_ptr, tuple)>;
+
+  // `setup` runs once on each new state, on its worker, concurrently with the other workers.  If
+  // it throws, the pool is torn down and the exception is rethrown here.
+  explicit state_pool(std::size_t workers, setup_function setup = {},
+                      state::options = state::std_libs);
+
+  // Waits for the queued jobs to finish.
+  ~state_pool() noexcept;
+
+  state_pool(const state_pool&) = delete;
+  auto operator=(const state_pool&) -> state_pool& = delete;
+
+  auto size() const noexcept -> std::size_t;
+
+  template <typename F> auto submit(F f) -> std::future<std::invoke_result_t<F&, const state&>>
+  {
+    using R = std::invoke_result_t<F&, const state&>;
+
+    auto promise = std::make_shared<std::promise<R>>();
+    auto future = promise->get_future();
+
+    post([f = std::move(f), promise = std::move(promise)](const state& s) mutable {
+      try {
+        if constexpr (std::is_void_v<R>) {
+          f(s);
+          promise->set_value();
+        } else {
+          promise->set_value(f(s));
+        }
+      } catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+    });
+
+    return future;
+  }
+
+  // Runs Lua source, as `state::do_string`.
+  auto run(std::string code) -> std::future<tuple>;
+  auto run(std::string code, completion) -> void;
+
+  // Calls a global function.
+  auto call(std::string name, tuple args) -> std::future<tuple>;
+  auto call(std::string name, tuple args, completion) -> void;
+
+private:
+  struct data;
+
+  auto post(std::function<void(const state&)>) -> void;
+  auto stop() noexcept -> void;
+
+  std::unique_ptr<data> data_;
+};
+
+namespace detail
+{
+// Values that do not belong to any state: throws for tables, functions, userdata and threads.
+auto detach(tuple) -> tuple;
+} // namespace detail
+
+} // namespace lua
+
+#endif // LUAPP_STATE_POOL_HPP_INCLUDED
@@ -0,0 +1,55 @@
+#ifndef LUAPP_STATS_HPP_INCLUDED
+#define LUAPP_STATS_HPP_INCLUDED
+
+#include <array>
+#include <cstddef>
+
+extern "C" {
+#include <lua.h>
+}
+
+// Expands to its arguments only when the library is built with the `LUAPP_STATS` option, so that
+// counting compiles out entirely otherwise.
+#ifdef LUAPP_STATS
+#define LUAPP_STAT(...) __VA_ARGS__
+#else
+#define LUAPP_STAT(...)
+#endif
+
+namespace lua
+{
+
+struct state_data;
+
+// Internal operations of a state, counted when the library is built with `LUAPP_STATS` and all
+// zero otherwise.
+struct state_stats
+{
+  std::size_t refs_created = 0;
+  std::size_t refs_released = 0;
+  std::size_t stack_growths = 0;                      // by `lua_checkstack`
+  std::array<std::size_t, LUA_NUMTAGS> conversions{}; // values read from Lua, by `lua_type`
+  std::size_t strings_copied = 0;
+  std::size_t string_bytes = 0;
+  std::size_t closures_created = 0; // C++ functions pushed while not in the closure cache
+  std::size_t userdata_created = 0;
+  std::size_t userdata_finalized = 0;
+  std::size_t compilations = 0; // by `do_string`, not served by the chunk cache
+
+  // A steady rise means handles are being leaked.
+  auto live_refs() const noexcept -> std::size_t { return refs_created - refs_released; }
+};
+
+namespace detail
+{
+#ifdef LUAPP_STATS
+auto check_stack(lua_State* state, int n) -> bool;
+auto count_string(state_data&, std::size_t size) noexcept -> void;
+#else
+inline auto check_stack(lua_State* state, int n) -> bool { return lua_checkstack(state, n); }
+#endif
+} // namespace detail
+
+} // namespace lua
+
+#endif // LUAPP_STATS_HPP_INCLUDED
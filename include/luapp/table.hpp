@@ -1,12 +1,22 @@
 #ifndef LUAPP_TABLE_HPP_INCLUDED
 #define LUAPP_TABLE_HPP_INCLUDED
 
+#include <algorithm>
+#include <cstddef>
 #include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #include <lua.h>
 }
 
+#include <luapp/key.hpp>
 #include <luapp/reference.hpp>
 
 namespace lua
@@ -15,10 +25,93 @@ namespace lua
 class state;
 class value;
 
+// How elements are checked when copying a Lua array into C++.
+//   strict: the Lua type must match (any number is accepted as floating point);
+//   coerce: whatever Lua itself converts is accepted, e.g. numeric strings or 2.0 as an integer.
+enum class conversion { strict, coerce };
+
 namespace detail
 {
 struct getter;
 struct setter;
+
+template <typename T>
+constexpr bool is_character_v =
+  std::is_same_v<T, char> || std::is_same_v<T, wchar_t> || std::is_same_v<T, char8_t> ||
+  std::is_same_v<T, char16_t> || std::is_same_v<T, char32_t>;
+
+template <typename T>
+constexpr bool is_array_element_v = (std::is_arithmetic_v<T> && !is_character_v<T>) ||
+                                    std::is_same_v<T, std::string>;
+
+template <typename T>
+constexpr bool is_pushable_element_v =
+  is_array_element_v<T> || std::is_same_v<T, std::string_view> || std::is_same_v<T, const char*>;
+
+struct stack_guard
+{
+  lua_State* state;
+  int top;
+  ~stack_guard() { lua_settop(state, top); }
+};
+
+template <typename T> auto push_element(lua_State* state, const T& v) -> void
+{
+  if constexpr (std::is_same_v<T, bool>)
+    lua_pushboolean(state, v);
+  else if constexpr (std::is_integral_v<T>)
+    lua_pushinteger(state, static_cast<lua_Integer>(v));
+  else if constexpr (std::is_floating_point_v<T>)
+    lua_pushnumber(state, static_cast<lua_Number>(v));
+  else if constexpr (std::is_same_v<T, const char*>)
+    lua_pushstring(state, v);
+  else
+    lua_pushlstring(state, v.data(), v.size());
+}
+
+// Converts the element at the top of the stack; `i` is only used for error messages.
+template <typename T> auto read_element(lua_State* state, std::size_t i, conversion c) -> T
+{
+  const auto fail = [&]() -> T {
+    throw std::runtime_error{"invalid array element at index " + std::to_string(i)};
+  };
+
+  if constexpr (std::is_same_v<T, bool>) {
+    if (c == conversion::strict && lua_type(state, -1) != LUA_TBOOLEAN)
+      return fail();
+    return lua_toboolean(state, -1);
+  } else if constexpr (std::is_integral_v<T>) {
+    if (c == conversion::strict && !lua_isinteger(state, -1))
+      return fail();
+
+    int isnum;
+    const auto x = lua_tointegerx(state, -1, &isnum);
+    if (!isnum)
+      return fail();
+
+    if (c == conversion::strict && !std::in_range<T>(x))
+      return fail();
+
+    return static_cast<T>(x);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    if (c == conversion::strict && lua_type(state, -1) != LUA_TNUMBER)
+      return fail();
+
+    int isnum;
+    const auto x = lua_tonumberx(state, -1, &isnum);
+    if (!isnum)
+      return fail();
+    return static_cast<T>(x);
+  } else {
+    if (c == conversion::strict ? lua_type(state, -1) != LUA_TSTRING : !lua_isstring(state, -1))
+      return fail();
+
+    std::size_t len;
+    const auto* p = lua_tolstring(state, -1, &len);
+    return T(p, len);
+  }
+}
+
 } // namespace detail
 
 class table
@@ -27,6 +120,8 @@ class table
   friend class value;
   friend class userdata;
   friend class function;
+  friend class pairs;
+  friend class ipairs;
   friend struct detail::getter;
   friend struct detail::setter;
 
@@ -35,17 +130,60 @@ public:
   auto operator==(const table&) const -> bool;
   auto operator!=(const table&) const -> bool;
 
+  // Copies t[1], ..., t[n] into `out`, where n is the smaller of `out.size()` and the raw length
+  // of the table.  Returns n.  Metamethods are not consulted.
+  template <typename T>
+  auto copy_to(std::span<T> out, conversion c = conversion::strict) const -> std::size_t
+  {
+    static_assert(detail::is_array_element_v<T>, "unsupported element type");
+
+    const auto [state, size] = push_array();
+    const detail::stack_guard guard{state, lua_gettop(state) - 1};
+
+    const auto n = std::min(size, out.size());
+    for (std::size_t i = 0; i < n; ++i) {
+      lua_rawgeti(state, -1, static_cast<lua_Integer>(i + 1));
+      out[i] = detail::read_element<T>(state, i + 1, c);
+      lua_pop(state, 1);
+    }
+
+    return n;
+  }
+
+  template <typename T> auto to_vector(conversion c = conversion::strict) const -> std::vector<T>
+  {
+    static_assert(detail::is_array_element_v<T>, "unsupported element type");
+
+    const auto [state, size] = push_array();
+    const detail::stack_guard guard{state, lua_gettop(state) - 1};
+
+    std::vector<T> result(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      lua_rawgeti(state, -1, static_cast<lua_Integer>(i + 1));
+      result[i] = detail::read_element<T>(state, i + 1, c);
+      lua_pop(state, 1);
+    }
+
+    return result;
+  }
+
 private:
   explicit table(reference) noexcept;
 
-  auto get(const value&) const -> reference;
+  auto get(const value&) const -> value;
   auto set(const value&, const value&) const -> void;
 
-  auto push(std::shared_ptr<state_data>) const -> int;
-  auto push(std::shared_ptr<state_data>, lua_State*) const -> int;
+  auto get(const key&) const -> value;
+  auto set(const key&, const value&) const -> void;
+
+  auto push(state_data&) const -> int;
+  auto push(state_data&, lua_State*) const -> int;
 
   auto as_value() -> const value&;
 
+  // pushes the table (the caller pops it) and returns its raw length.
+  auto push_array() const -> std::pair<lua_State*, std::size_t>;
+
   reference ref_;
 };
 
@@ -0,0 +1,139 @@
+#ifndef LUAPP_TASK_HPP_INCLUDED
+#define LUAPP_TASK_HPP_INCLUDED
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace lua
+{
+
+// A lazily started C++ coroutine returning `T`.  It runs when awaited, and resumes its awaiter
+// when done.  Start top-level tasks with `scheduler::spawn`.
+template <typename T = void> class task;
+
+namespace detail
+{
+struct task_promise_base
+{
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  struct final_awaiter
+  {
+    auto await_ready() const noexcept -> bool { return false; }
+
+    template <typename P>
+    auto await_suspend(std::coroutine_handle<P> h) const noexcept -> std::coroutine_handle<>
+    {
+      if (const auto c = h.promise().continuation)
+        return c;
+      return std::noop_coroutine();
+    }
+
+    auto await_resume() const noexcept -> void {}
+  };
+
+  auto initial_suspend() const noexcept -> std::suspend_always { return {}; }
+  auto final_suspend() const noexcept -> final_awaiter { return {}; }
+  auto unhandled_exception() noexcept -> void { error = std::current_exception(); }
+};
+
+template <typename T> struct task_promise : task_promise_base
+{
+  std::optional<T> result;
+
+  auto get_return_object() noexcept -> task<T>;
+  template <typename U> auto return_value(U&& v) -> void { result.emplace(std::forward<U>(v)); }
+
+  auto get() -> T
+  {
+    if (error)
+      std::rethrow_exception(error);
+    return std::move(*result);
+  }
+};
+
+template <> struct task_promise<void> : task_promise_base
+{
+  auto get_return_object() noexcept -> task<void>;
+  auto return_void() const noexcept -> void {}
+
+  auto get() const -> void
+  {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+} // namespace detail
+
+template <typename T> class task
+{
+public:
+  using promise_type = detail::task_promise<T>;
+
+  task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  auto operator=(task&& other) noexcept -> task&
+  {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~task() noexcept
+  {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  auto operator co_await() && noexcept
+  {
+    struct awaiter
+    {
+      std::coroutine_handle<promise_type> handle;
+
+      auto await_ready() const noexcept -> bool { return false; }
+
+      auto await_suspend(std::coroutine_handle<> awaiting) const noexcept
+        -> std::coroutine_handle<>
+      {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+
+      auto await_resume() const -> T { return handle.promise().get(); }
+    };
+
+    return awaiter{handle_};
+  }
+
+private:
+  friend promise_type;
+  friend class scheduler;
+
+  explicit task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail
+{
+template <typename T> auto task_promise<T>::get_return_object() noexcept -> task<T>
+{
+  return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+inline auto task_promise<void>::get_return_object() noexcept -> task<void>
+{
+  return task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+} // namespace detail
+
+} // namespace lua
+
+#endif // LUAPP_TASK_HPP_INCLUDED
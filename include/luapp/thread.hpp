@@ -0,0 +1,64 @@
+#ifndef LUAPP_THREAD_HPP_INCLUDED
+#define LUAPP_THREAD_HPP_INCLUDED
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <luapp/reference.hpp>
+
+namespace lua
+{
+
+struct state_data;
+class tuple;
+
+// A Lua coroutine.  Created by `state::create_thread` or read from Lua, where it is the value
+// returned by `coroutine.create`.
+class thread
+{
+  friend class scheduler;
+  friend class state;
+  friend class value;
+
+public:
+  enum class status {
+    suspended, // not started yet, or yielded
+    running,   // running or resuming another coroutine
+    dead,      // returned or failed
+  };
+
+  thread(const thread&) noexcept = default;
+  thread(thread&&) noexcept = default;
+
+  auto operator=(const thread&) noexcept -> thread& = default;
+  auto operator=(thread&&) noexcept -> thread& = default;
+
+  // Starts or continues the coroutine, passing `args` to its function or as the results of the
+  // `coroutine.yield` it is suspended at.  Returns the values it yields or, once finished,
+  // returns.  Errors are thrown as `do_string` does, and leave the coroutine dead.
+  auto resume(tuple args) const -> tuple;
+  auto resume() const -> tuple;
+
+  auto get_status() const -> status;
+
+  auto operator==(const thread&) const -> bool;
+  auto operator!=(const thread&) const -> bool;
+
+private:
+  explicit thread(reference) noexcept;
+
+  auto push(state_data&) const -> int;
+  auto push(state_data&, lua_State*) const -> int;
+
+  // the Lua thread, kept alive by `ref_`.
+  auto get() const -> lua_State*;
+
+  static auto status_of(lua_State*) -> status;
+
+  reference ref_;
+};
+
+} // namespace lua
+
+#endif // LUAPP_THREAD_HPP_INCLUDED
@@ -2,25 +2,49 @@
 #define LUAPP_TUPLE_HPP_INCLUDED
 
 #include <array>
+#include <cstddef>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <luapp/value.hpp>
+
+// Number of values a tuple holds without allocating.  Must be the same for the library and its
+// users.
+#ifndef LUAPP_TUPLE_INLINE_CAPACITY
+#define LUAPP_TUPLE_INLINE_CAPACITY 4
+#endif
+
 namespace lua
 {
 
-class value;
-
+// Values past the end read as nil.  Up to `inline_capacity` values are kept inline.
 class tuple
 {
 public:
-  tuple();
+  static constexpr std::size_t inline_capacity = LUAPP_TUPLE_INLINE_CAPACITY;
+
+  tuple() noexcept = default;
 
   explicit tuple(std::vector<value>) noexcept;
 
-  template <typename... Args>
-  explicit tuple(Args&&... args) : tuple(std::vector<value>{std::forward<Args>(args)...})
+  tuple(const tuple&) = default;
+  tuple(tuple&&) noexcept; // leaves the other empty
+
+  auto operator=(const tuple&) -> tuple& = default;
+  auto operator=(tuple&&) noexcept -> tuple&;
+
+  template <typename... Args> explicit tuple(Args&&... args) : size_(sizeof...(Args))
   {
     static_assert((std::is_constructible_v<value, Args> && ...));
+
+    if constexpr (sizeof...(Args) <= inline_capacity) {
+      std::size_t i = 0;
+      ((inline_[i++] = value(std::forward<Args>(args))), ...);
+    } else {
+      heap_ = std::vector<value>{value(std::forward<Args>(args))...};
+    }
   }
 
   template <typename R, typename... Args> auto apply(R (*f)(Args...)) const -> tuple
@@ -72,9 +96,17 @@ private:
     return {{at(I)...}};
   }
 
-  std::vector<value> values_; // last is always nil
+  auto data() const noexcept -> const value*;
+
+  auto clear() noexcept -> void;
+
+  std::size_t size_ = 0;
+  std::array<value, inline_capacity> inline_; // unused slots are nil
+  std::vector<value> heap_;                   // all the values, if more than fit inline
 };
 
 } // namespace lua
 
+#include <luapp/binding.hpp>
+
 #endif // LUAPP_TUPLE_HPP_INCLUDED
@@ -10,7 +10,7 @@ extern "C" {
 
 #include <luapp/function.hpp>
 #include <luapp/table.hpp>
-#include <luapp/tuple.hpp>
+#include <luapp/thread.hpp>
 #include <luapp/userdata.hpp>
 
 namespace lua
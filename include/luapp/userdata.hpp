@@ -1,20 +1,41 @@
 #ifndef LUAPP_USERDATA_HPP_INCLUDED
 #define LUAPP_USERDATA_HPP_INCLUDED
 
-#include <any>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <optional>
+#include <new>
+#include <type_traits>
 #include <typeindex>
+#include <typeinfo>
+#include <utility>
 
 #include <luapp/table.hpp>
 
 namespace lua
 {
 
+namespace detail
+{
+struct binding;
+
+// Identifies the type of the objects held by userdata: one address per type.
+struct userdata_type
+{
+  const std::type_info& info;
+};
+
+template <typename T> inline constexpr userdata_type type_tag{typeid(T)};
+} // namespace detail
+
+// A Lua userdata created by the library.  Its object is either shared, owned by a
+// `std::shared_ptr` that the userdata holds a copy of, or stored inline in the Lua allocation
+// itself and destroyed when Lua collects it.
 class userdata
 {
   friend class value;
   friend class state;
+  friend struct detail::binding;
 
 public:
   userdata(const userdata&) = default;
@@ -23,33 +44,122 @@ public:
   auto operator=(const userdata&) -> userdata& = default;
   auto operator=(userdata&&) noexcept -> userdata& = default;
 
-  template <typename T> auto cast() const noexcept -> std::shared_ptr<T>
+  // The object, if it is a `T`; valid while the userdata is alive.
+  template <typename T> auto get() const noexcept -> T*
+  {
+    static_assert(!std::is_same_v<T, void>);
+    using U = std::remove_cv_t<T>;
+    const auto* h = data();
+    if (h->tag != &detail::type_tag<U>)
+      return nullptr;
+    return object_of<U>(*h);
+  }
+
+  // The object, if it is a shared `T`.  Inline objects belong to Lua, which may destroy them
+  // while C++ still holds a pointer: they are only borrowed, with `get`.
+  template <typename T> auto cast() const -> std::shared_ptr<T>
   {
     static_assert(!std::is_same_v<T, void>);
-    if (const auto* p = std::any_cast<std::shared_ptr<std::decay_t<T>>>(data()); p)
-      return *p;
-    return nullptr;
+    using U = std::decay_t<T>;
+    const auto* h = data();
+    if (h->tag != &detail::type_tag<U> || h->destroy)
+      return nullptr;
+    return std::static_pointer_cast<U>(static_cast<const shared_header*>(h)->owner);
   }
 
-  template <typename T> operator std::shared_ptr<T>() const noexcept { return cast<T>(); }
+  template <typename T> operator std::shared_ptr<T>() const { return cast<T>(); }
+
+  // Type of the object, as created, or `void` once it has been finalized.
+  auto type() const -> std::type_index;
 
   // always consults the metatable.
   auto operator==(const userdata&) const -> bool;
   auto operator!=(const userdata&) const -> bool;
 
 private:
-  struct dummy
-  {};
+  // start of the Lua userdata, followed by the object if it is inline.
+  struct header
+  {
+    const detail::userdata_type* tag;  // `detail::type_tag` of the object's type
+    void (*destroy)(header&) noexcept; // of inline objects; null for shared ones
+  };
+
+  // followed by nothing: the object is owned by `owner`.
+  struct shared_header : header
+  {
+    void* object;
+    std::shared_ptr<void> owner;
+    std::size_t footprint; // bytes charged to the state
+  };
+
+  // The inline object of a userdata: the first address past the header aligned for it.
+  static auto inline_address(const header& h, std::size_t alignment) noexcept -> void*
+  {
+    const auto p = reinterpret_cast<std::uintptr_t>(&h + 1);
+    return reinterpret_cast<void*>((p + alignment - 1) / alignment * alignment);
+  }
+
+  template <typename T> static auto object_of(const header& h) noexcept -> T*
+  {
+    if (!h.destroy)
+      return static_cast<T*>(static_cast<const shared_header&>(h).object);
+    return std::launder(static_cast<T*>(inline_address(h, alignof(T))));
+  }
 
   explicit userdata(reference) noexcept;
-  userdata(const state&, std::type_index, std::any);
 
-  auto push(std::shared_ptr<state_data>) const -> int;
-  auto push(std::shared_ptr<state_data>, lua_State*) const -> int;
+  // pushes a new userdata holding an object.
+  template <typename T>
+  static auto push_shared(state_data& sdata, lua_State* state, std::shared_ptr<T> ptr,
+                          std::size_t footprint) -> void
+  {
+    auto* object = ptr.get();
+    new (allocate(state, sizeof(shared_header)))
+      shared_header{{&detail::type_tag<T>, nullptr}, object, std::move(ptr), footprint};
+    publish(sdata, state, typeid(T));
+  }
+
+  template <typename T, typename... Args>
+  static auto push_inline(state_data& sdata, lua_State* state, Args&&... args) -> void
+  {
+    // Lua aligns the block for its own types only, as the header needs; stricter objects are
+    // padded for.
+    constexpr auto padding = alignof(T) > alignof(header) ? alignof(T) - alignof(header) : 0;
+    auto* h = new (allocate(state, sizeof(header) + padding + sizeof(T))) header{};
+    try {
+      new (inline_address(*h, alignof(T))) T(std::forward<Args>(args)...);
+    } catch (...) {
+      discard(state);
+      throw;
+    }
+    h->destroy = [](header& self) noexcept { object_of<T>(self)->~T(); };
+    h->tag = &detail::type_tag<T>;
+    publish(sdata, state, typeid(T));
+  }
+
+  // pushes an uninitialized userdata of `size` bytes, for a header and its inline object.
+  static auto allocate(lua_State*, std::size_t size) -> void*;
+
+  // sets the metatable of the userdata at the top and charges its footprint.
+  static auto publish(state_data&, lua_State*, std::type_index) -> void;
+
+  // pops the userdata at the top, whose object could not be constructed.
+  static auto discard(lua_State*) noexcept -> void;
+
+  // anchors the userdata at the top of the main thread and pops it.
+  static auto pop(state_data&) -> userdata;
+
+  // The header of the value at `index` if it is a userdata created by the library, or null.  A
+  // pointer comparison: no metatable is looked at.
+  static auto header_at(lua_State*, int index) noexcept -> header*;
+
+  // destroys the object of a userdata being collected and clears its header.
+  static auto finalize(state_data&, header&) noexcept -> void;
 
-  auto data() const -> std::any*;
+  auto push(state_data&) const -> int;
+  auto push(state_data&, lua_State*) const -> int;
 
-  static auto create_reference(const state&, std::type_index, std::any) -> reference;
+  auto data() const -> const header*;
 
   reference ref_;
 };
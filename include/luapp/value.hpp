@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <optional>
+#include <string_view>
 #include <variant>
 
 #include <luapp/type.hpp>
@@ -10,15 +11,27 @@
 namespace lua
 {
 
+namespace detail
+{
+struct access;
+struct binding;
+} // namespace detail
+
 class value
-  : private std::variant<nil, floating, integer, boolean, string, function, userdata, table>
+  : private std::variant<nil, floating, integer, boolean, string, function, userdata, table, thread>
 {
-  using variant = std::variant<nil, floating, integer, boolean, string, function, userdata, table>;
+  using variant =
+    std::variant<nil, floating, integer, boolean, string, function, userdata, table, thread>;
 
   friend class function;
   friend class userdata;
   friend class table;
   friend class state;
+  friend class pairs;
+  friend class ipairs;
+  friend class thread;
+  friend struct detail::access;
+  friend struct detail::binding;
 
 public:
   constexpr value() noexcept = default;
@@ -40,6 +53,7 @@ public:
   value(std::optional<function>) noexcept;
   value(std::optional<userdata>) noexcept;
   value(std::optional<table>) noexcept;
+  value(std::optional<thread>) noexcept;
 
   template <typename R, typename... Args> value(R (*f)(Args...)) : value(function(f)) {}
 
@@ -70,6 +84,7 @@ public:
   constexpr auto is_function() const noexcept -> bool { return is<function>(); }
   constexpr auto is_userdata() const noexcept -> bool { return is<userdata>(); }
   constexpr auto is_table() const noexcept -> bool { return is<table>(); }
+  constexpr auto is_thread() const noexcept -> bool { return is<thread>(); }
 
   constexpr auto as_variant() const noexcept -> const variant& { return *this; }
   constexpr auto as_variant() noexcept -> variant& { return *this; }
@@ -105,9 +120,16 @@ public:
   }
 
   auto get_string_or(string) const -> string;
+
+  // without copying; the result is only valid while this value is alive, so temporaries are
+  // refused.
+  auto get_string_view_or(std::string_view) const& noexcept -> std::string_view;
+  auto get_string_view_or(std::string_view) const&& -> std::string_view = delete;
+
   auto get_function_or(function) const noexcept -> function;
   auto get_userdata_or(userdata) const -> userdata;
   auto get_table_or(table) const noexcept -> table;
+  auto get_thread_or(thread) const noexcept -> thread;
 
   constexpr operator std::optional<boolean>() const noexcept
   {
@@ -133,9 +155,12 @@ public:
   }
 
   operator std::optional<string>() const;
+  operator std::optional<std::string_view>() const& noexcept;
+  operator std::optional<std::string_view>() const&& = delete;
   operator std::optional<function>() const noexcept;
   operator std::optional<userdata>() const;
   operator std::optional<table>() const noexcept;
+  operator std::optional<thread>() const noexcept;
 
   template <typename... T>
   constexpr operator std::variant<nil, T...>() const
@@ -151,7 +176,7 @@ public:
       as_variant());
   }
 
-  template <typename T> operator std::shared_ptr<T>() const noexcept
+  template <typename T> operator std::shared_ptr<T>() const
   {
     return std::visit(
       [](const auto& value) -> std::shared_ptr<T> {
@@ -167,14 +192,17 @@ public:
   auto operator!=(const value&) const -> bool;
 
 private:
-  static auto at(std::shared_ptr<state_data>, int) -> value;
-  static auto at(std::shared_ptr<state_data>, lua_State*, int) -> value;
-  static auto from_ref(std::shared_ptr<state_data>, const reference&) -> variant;
+  static auto at(state_data&, int) -> value;
+  static auto at(state_data&, lua_State*, int) -> value;
+  static auto from_ref(const reference&) -> variant;
+
+  static auto checkudata(lua_State*, int index, reference) -> value;
 
-  static auto checkudata(std::shared_ptr<state_data>, reference) -> value;
+  // the string at `index`, embedded zeros included.
+  static auto string_at(state_data&, lua_State*, int index) -> string;
 
-  auto push(std::shared_ptr<state_data>) const -> int;
-  auto push(std::shared_ptr<state_data>, lua_State*) const -> int;
+  auto push(state_data&) const -> int;
+  auto push(state_data&, lua_State*) const -> int;
 };
 
 namespace detail
@@ -182,16 +210,23 @@ namespace detail
 struct getter
 {
   auto operator()(const table&, const value&) const -> value;
+  auto operator()(const table&, const key&) const -> value;
 };
 struct setter
 {
   auto operator()(const table&, const value&, const value&) const -> void;
+  auto operator()(const table&, const key&, const value&) const -> void;
 };
 } // namespace detail
 
 auto get(const table&, const value&) -> value;
 auto set(const table&, const value&, const value&) -> void;
 
+auto get(const table&, const key&) -> value;
+auto set(const table&, const key&, const value&) -> void;
+
 } // namespace lua
 
+#include <luapp/tuple.hpp>
+
 #endif // LUAPP_VALUE_HPP_INCLUDED
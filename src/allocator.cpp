@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <luapp/allocator.hpp>
+
+namespace lua
+{
+
+namespace
+{
+
+constexpr std::size_t alignment = alignof(std::max_align_t);
+
+constexpr auto align_up(std::size_t size) noexcept -> std::size_t
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Moves a block to a new allocation, for policies that cannot resize in place.
+template <typename Allocate, typename Free>
+auto move_block(void* ptr, std::size_t osize, std::size_t nsize, Allocate allocate,
+                Free free) noexcept -> void*
+{
+  auto* p = allocate(nsize);
+  if (!p)
+    return nullptr;
+
+  std::memcpy(p, ptr, std::min(osize, nsize));
+  free(ptr, osize);
+  return p;
+}
+
+// pool_allocator
+
+constexpr std::size_t granularity = pool_allocator::granularity;
+constexpr std::size_t classes = pool_allocator::max_pooled / granularity;
+constexpr std::size_t slab_size = 64 * 1024;
+
+static_assert(granularity % alignment == 0);
+
+struct free_block
+{
+  free_block* next;
+};
+
+using free_lists = std::array<free_block*, classes>;
+
+using list_sizes = std::array<std::size_t, classes>;
+
+struct depot
+{
+  std::mutex mutex;
+  free_lists lists{};
+  list_sizes sizes{};
+  std::vector<void*> slabs; // never released: blocks may outlive the thread that carved them.
+};
+
+auto global_depot() -> depot&
+{
+  static auto* d = new depot;
+  return *d;
+}
+
+// Trivially destructible, so that they remain usable even while the thread is being torn down.
+thread_local free_lists thread_cache{};
+thread_local list_sizes thread_cache_sizes{};
+
+// Moves the first `n` blocks of a class from the cache of this thread to the depot.
+auto flush(std::size_t c, std::size_t n) noexcept -> void
+{
+  if (n == 0)
+    return;
+
+  auto* first = thread_cache[c];
+  auto* last = first;
+  for (std::size_t i = 1; i < n; ++i)
+    last = last->next;
+  thread_cache[c] = last->next;
+  thread_cache_sizes[c] -= n;
+
+  auto& d = global_depot();
+  const std::lock_guard lock(d.mutex);
+  last->next = d.lists[c];
+  d.lists[c] = first;
+  d.sizes[c] += n;
+}
+
+struct thread_cache_flusher
+{
+  ~thread_cache_flusher()
+  {
+    for (std::size_t c = 0; c < classes; ++c)
+      flush(c, thread_cache_sizes[c]);
+  }
+};
+
+// Set up by the first block a thread caches, so that the cache of a thread that only frees is
+// not lost either.
+auto register_flusher() noexcept -> void
+{
+  thread_local thread_cache_flusher flusher;
+  static_cast<void>(flusher);
+}
+
+constexpr auto class_of(std::size_t size) noexcept -> std::size_t
+{
+  return (size - 1) / granularity;
+}
+
+// Blocks a thread may cache per class, a slab's worth; half of them go to the depot beyond that.
+constexpr auto cache_limit(std::size_t c) noexcept -> std::size_t
+{
+  return slab_size / ((c + 1) * granularity);
+}
+
+auto refill(std::size_t c) noexcept -> free_block*
+{
+  register_flusher();
+
+  auto& d = global_depot();
+  const std::lock_guard lock(d.mutex);
+
+  if (auto* head = std::exchange(d.lists[c], nullptr)) {
+    thread_cache_sizes[c] = std::exchange(d.sizes[c], 0);
+    return head;
+  }
+
+  auto* slab = static_cast<std::byte*>(std::malloc(slab_size));
+  if (!slab)
+    return nullptr;
+
+  try {
+    d.slabs.push_back(slab);
+  } catch (...) {
+    std::free(slab);
+    return nullptr;
+  }
+
+  const auto size = (c + 1) * granularity;
+  free_block* head = nullptr;
+  for (std::size_t offset = 0; offset + size <= slab_size; offset += size)
+    head = new (slab + offset) free_block{head};
+
+  thread_cache_sizes[c] = cache_limit(c);
+  return head;
+}
+
+auto pool_allocate(std::size_t size) noexcept -> void*
+{
+  if (size > pool_allocator::max_pooled)
+    return std::malloc(size);
+
+  const auto c = class_of(size);
+  auto*& head = thread_cache[c];
+  if (!head && !(head = refill(c)))
+    return nullptr;
+
+  auto* b = head;
+  head = b->next;
+  --thread_cache_sizes[c];
+  return b;
+}
+
+auto pool_free(void* ptr, std::size_t size) noexcept -> void
+{
+  if (size > pool_allocator::max_pooled)
+    return std::free(ptr);
+
+  const auto c = class_of(size);
+  auto*& head = thread_cache[c];
+  if (!head)
+    register_flusher();
+  head = new (ptr) free_block{head};
+
+  if (++thread_cache_sizes[c] > cache_limit(c))
+    flush(c, thread_cache_sizes[c] - cache_limit(c) / 2);
+}
+
+} // namespace
+
+// default_allocator
+
+auto default_allocator::reallocate(void* ptr, std::size_t, std::size_t nsize) noexcept -> void*
+{
+  if (nsize == 0) {
+    std::free(ptr);
+    return nullptr;
+  }
+  return std::realloc(ptr, nsize);
+}
+
+// pool_allocator
+
+auto pool_allocator::reallocate(void* ptr, std::size_t osize, std::size_t nsize) noexcept -> void*
+{
+  if (nsize == 0) {
+    if (ptr)
+      pool_free(ptr, osize);
+    return nullptr;
+  }
+
+  if (!ptr)
+    return pool_allocate(nsize);
+
+  if (osize > max_pooled && nsize > max_pooled)
+    return std::realloc(ptr, nsize);
+
+  if (osize <= max_pooled && nsize <= max_pooled && class_of(osize) == class_of(nsize))
+    return ptr;
+
+  return move_block(ptr, osize, nsize, pool_allocate, pool_free);
+}
+
+// arena_allocator
+
+struct arena_allocator::block
+{
+  block* next;
+};
+
+namespace
+{
+constexpr std::size_t arena_header = align_up(sizeof(void*));
+}
+
+arena_allocator::arena_allocator(std::size_t block_size) noexcept
+  : block_size_(std::max(block_size, arena_header + alignment))
+{}
+
+arena_allocator::~arena_allocator() noexcept
+{
+  while (blocks_) {
+    auto* next = blocks_->next;
+    std::free(blocks_);
+    blocks_ = next;
+  }
+}
+
+auto arena_allocator::reserved() const noexcept -> std::size_t { return reserved_; }
+
+auto arena_allocator::bump(std::size_t size) noexcept -> std::byte*
+{
+  size = align_up(size);
+
+  if (static_cast<std::size_t>(limit_ - cursor_) < size) {
+    const auto total = std::max(block_size_, arena_header + size);
+    auto* raw = static_cast<std::byte*>(std::malloc(total));
+    if (!raw)
+      return nullptr;
+
+    blocks_ = new (raw) block{blocks_};
+    reserved_ += total;
+    cursor_ = raw + arena_header;
+    limit_ = raw + total;
+  }
+
+  last_ = cursor_;
+  cursor_ += size;
+  return last_;
+}
+
+auto arena_allocator::reallocate(void* ptr, std::size_t osize, std::size_t nsize) noexcept -> void*
+{
+  auto* p = static_cast<std::byte*>(ptr);
+
+  if (nsize == 0) {
+    if (p && p == last_) {
+      cursor_ = last_;
+      last_ = nullptr;
+    }
+    return nullptr;
+  }
+
+  if (!p)
+    return bump(nsize);
+
+  if (p == last_ && static_cast<std::size_t>(limit_ - p) >= align_up(nsize)) {
+    cursor_ = p + align_up(nsize);
+    return p;
+  }
+
+  if (nsize <= osize)
+    return p;
+
+  auto* q = bump(nsize);
+  if (!q)
+    return nullptr;
+
+  std::memcpy(q, p, osize);
+  return q;
+}
+
+} // namespace lua
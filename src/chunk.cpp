@@ -0,0 +1,47 @@
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <cool/defer.hpp>
+#include <luapp/chunk.hpp>
+#include <luapp/state.hpp>
+
+namespace lua
+{
+
+chunk::chunk(reference ref, std::string name, std::shared_ptr<histogram> latency) noexcept
+  : function(std::move(ref), std::move(latency)), name_(std::move(name))
+{}
+
+auto chunk::name() const noexcept -> const std::string& { return name_; }
+
+auto chunk::dump(bool strip) const -> std::vector<std::byte>
+{
+  const auto& ref = std::get<script>(f_).ref;
+  auto& sdata = *ref.state();
+  const auto state = sdata.state;
+
+  ref.push(sdata);
+  COOL_DEFER(lua_pop(state, 1));
+
+  std::vector<std::byte> out;
+  const auto writer = +[](lua_State*, const void* p, std::size_t size, void* ud) -> int {
+    try {
+      const auto* bytes = static_cast<const std::byte*>(p);
+      auto& out = *static_cast<std::vector<std::byte>*>(ud);
+      out.insert(out.end(), bytes, bytes + size);
+      return 0;
+    } catch (...) {
+      return 1;
+    }
+  };
+
+  if (lua_dump(state, writer, &out, strip))
+    throw std::runtime_error{"unable to dump chunk"};
+
+  return out;
+}
+
+} // namespace lua
@@ -1,13 +1,20 @@
+#include <exception>
 #include <functional>
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <variant>
+
+extern "C" {
+#include <lua.h>
+}
 
 #include <cool/compose.hpp>
 #include <cool/indices.hpp>
+#include <luapp/binding.hpp>
 #include <luapp/function.hpp>
 #include <luapp/state.hpp>
 #include <luapp/value.hpp>
-#include <variant>
 
 namespace lua
 {
@@ -16,6 +23,8 @@ function::function(std::function<tuple(tuple)> f) noexcept
   : f_(std::make_shared<std::function<tuple(tuple)>>(std::move(f)))
 {}
 
+function::function(native n) noexcept : f_(std::move(n)) {}
+
 auto function::call(tuple t) const -> tuple
 {
   return std::visit( //
@@ -23,20 +32,22 @@ auto function::call(tuple t) const -> tuple
       [&](const std::shared_ptr<std::function<tuple(tuple)>>& f) -> tuple {
         return (*f)(std::move(t));
       },
-      [&](const reference& ref) -> tuple {
-        auto sdata = ref.state();
-        const auto state = sdata->state;
+      [&](const native& n) -> tuple { return (*n.generic)(std::move(t)); },
+      [&](const script& s) -> tuple {
+        const auto& ref = s.ref;
+        auto& sdata = *ref.state();
+        const auto state = sdata.state;
+        reference::collect(sdata);
+
         const auto last_top = lua_gettop(state);
 
         ref.push(sdata);
+        const detail::latency_timer timer(s.latency.get());
+
         for (const auto i : cool::indices(t.size()))
           t[i].push(sdata);
 
-        if (lua_pcall(state, t.size(), LUA_MULTRET, 0)) {
-          std::string error = lua_tostring(state, -1);
-          lua_pop(state, 1);
-          throw std::runtime_error{std::move(error)};
-        }
+        detail::pcall(sdata, t.size());
 
         const auto n = lua_gettop(state) - last_top;
         t.resize(n);
@@ -51,63 +62,111 @@ auto function::call(tuple t) const -> tuple
     f_);
 }
 
-function::function(reference ref) noexcept : f_(std::move(ref)) {}
+function::function(reference ref, std::shared_ptr<histogram> latency) noexcept
+  : f_(script{std::move(ref), std::move(latency)})
+{}
 
-auto function::push(std::shared_ptr<state_data> sdata) const -> int
+auto function::push(state_data& sdata) const -> int
 {
-  const auto state = sdata->state;
-  return push(std::move(sdata), state);
+  const auto state = sdata.state;
+  return push(sdata, state);
 }
 
-auto function::push(std::shared_ptr<state_data> sdata, lua_State* state) const -> int
+auto function::push(state_data& sdata, lua_State* state) const -> int
 {
-  if (std::holds_alternative<reference>(f_))
-    return std::get<reference>(f_).push(std::move(sdata), state);
-
-  const auto& f = std::get<std::shared_ptr<std::function<tuple(tuple)>>>(f_);
-  using fn_t = std::shared_ptr<std::function<tuple(tuple)>>;
-  {
-    auto* p = lua_newuserdata(state, sizeof(fn_t));
-    new (p) fn_t(f);
-    sdata->metatables.at(typeid(fn_t)).push(sdata, state);
+  if (!detail::check_stack(state, 3))
+    throw std::bad_alloc{};
+
+  // the callable is kept in a full userdata, upvalue of the trampoline.  The closure is cached
+  // by the address of the callable, which it keeps alive.
+  const auto push_closure = [&](const auto& target, lua_CFunction trampoline) -> int {
+    using target_t = std::decay_t<decltype(target)>;
+
+    lua_rawgeti(state, LUA_REGISTRYINDEX, sdata.functions);
+    if (lua_rawgetp(state, -1, target.get()) == LUA_TFUNCTION) {
+      lua_remove(state, -2);
+      return LUA_TFUNCTION;
+    }
+    lua_pop(state, 1);
+
+    LUAPP_STAT(++sdata.stats.closures_created);
+    auto* p = lua_newuserdata(state, sizeof(target_t));
+    new (p) target_t(target);
+    sdata.metatables.at(typeid(target_t)).push(sdata, state);
     lua_setmetatable(state, -2);
-  }
 
-  using weak_state = std::weak_ptr<state_data>;
-  {
-    auto* p = lua_newuserdata(state, sizeof(weak_state));
-    new (p) weak_state(sdata);
-    sdata->metatables.at(typeid(weak_state)).push(sdata, state);
-    lua_setmetatable(state, -2);
+    lua_pushcclosure(state, trampoline, 1);
+
+    lua_pushvalue(state, -1);
+    lua_rawsetp(state, -3, target.get());
+    lua_remove(state, -2);
+    return LUA_TFUNCTION;
+  };
+
+  return std::visit( //
+    cool::compose{
+      [&](const std::shared_ptr<std::function<tuple(tuple)>>& f) -> int {
+        return push_closure(f, &detail::binding::generic_trampoline);
+      },
+      [&](const native& n) -> int { return push_closure(n.target, n.trampoline); },
+      [&](const script& s) -> int { return s.ref.push(sdata, state); },
+    },
+    f_);
+}
+
+auto detail::is_cpp_function(lua_State* state, int index) -> bool
+{
+  index = lua_absindex(state, index);
+  if (!lua_iscfunction(state, index) || !lua_getupvalue(state, index, 1))
+    return false;
+
+  auto result = false;
+  if (lua_type(state, -1) == LUA_TUSERDATA && lua_getmetatable(state, -1)) {
+    lua_pushstring(state, "__luapp_function");
+    result = lua_rawget(state, -2) == LUA_TBOOLEAN;
+    lua_pop(state, 2);
   }
+  lua_pop(state, 1);
+  return result;
+}
 
-  lua_pushcclosure(
-    state,
-    +[](lua_State* state) -> int {
-      const auto f = *reinterpret_cast<fn_t*>(lua_touserdata(state, lua_upvalueindex(1)));
-      const auto sdata =
-        reinterpret_cast<weak_state*>(lua_touserdata(state, lua_upvalueindex(2)))->lock();
+auto detail::binding::generic_trampoline(lua_State* state) -> int
+{
+  using fn_t = std::shared_ptr<std::function<tuple(tuple)>>;
 
-      if (!f || !sdata)
-        return 0;
+  char message[256];
+  try {
+    const auto f = *static_cast<fn_t*>(lua_touserdata(state, lua_upvalueindex(1)));
+    if (!f)
+      return 0;
 
-      const auto nargs = lua_gettop(state);
+    // a running state is necessarily open.
+    auto& sdata = state_of(state);
 
-      tuple args;
-      args.resize(nargs);
+    const auto nargs = lua_gettop(state);
 
-      for (const auto i : cool::closed_indices(1, nargs))
-        args[i - 1] = value::at(sdata, state, i);
+    tuple args;
+    args.resize(nargs);
 
-      const auto ret = (*f)(args);
-      for (const auto i : cool::indices(ret.size()))
-        ret[i].push(sdata, state);
+    for (const auto i : cool::closed_indices(1, nargs))
+      args[i - 1] = value::at(sdata, state, i);
 
-      return ret.size();
-    },
-    2);
+    return push(sdata, state, (*f)(std::move(args)));
+  } catch (const std::exception& e) {
+    copy_message(message, sizeof(message), e.what());
+  } catch (...) {
+    copy_message(message, sizeof(message), "unknown C++ exception");
+  }
 
-  return LUA_TFUNCTION;
+  lua_pushstring(state, message);
+  return lua_error(state);
+}
+
+auto detail::binding::bad_argument(lua_State* state, int index, const char* expected)
+  -> std::runtime_error
+{
+  return std::runtime_error{"bad argument #" + std::to_string(index) + " (" + expected +
+                            " expected, got " + lua_typename(state, lua_type(state, index)) + ")"};
 }
 
 auto function::operator==(const function&) const -> bool { return false; }
@@ -0,0 +1,20 @@
+#include <string_view>
+#include <utility>
+
+#include <luapp/key.hpp>
+#include <luapp/state.hpp>
+
+namespace lua
+{
+
+key::key(reference ref, std::string_view name) noexcept : ref_(std::move(ref)), name_(name) {}
+
+auto key::name() const noexcept -> std::string_view { return name_; }
+
+auto key::push(lua_State* state) const -> void
+{
+  // the registry lookup of `reference::push`; callers have already reserved the stack slot.
+  lua_rawgeti(state, LUA_REGISTRYINDEX, ref_.data_->index);
+}
+
+} // namespace lua
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <luapp/metrics.hpp>
+
+namespace lua
+{
+
+auto histogram::index_of(std::uint64_t ns) noexcept -> std::size_t
+{
+  if (ns < sub_buckets)
+    return static_cast<std::size_t>(ns);
+
+  ns = std::min(ns, (std::uint64_t{1} << max_bits) - 1);
+  const auto e = static_cast<unsigned>(std::bit_width(ns)) - 1;
+  const auto sub = static_cast<std::size_t>(ns >> (e - sub_bits)) - sub_buckets;
+  return (e - sub_bits + 1) * sub_buckets + sub;
+}
+
+auto histogram::highest_of(std::size_t index) noexcept -> std::uint64_t
+{
+  if (index < sub_buckets)
+    return index;
+
+  const auto shift = static_cast<unsigned>(index / sub_buckets) - 1;
+  const auto lowest = static_cast<std::uint64_t>(sub_buckets + index % sub_buckets) << shift;
+  return lowest + (std::uint64_t{1} << shift) - 1;
+}
+
+auto histogram::record(std::uint64_t ns) noexcept -> void
+{
+  counts_[index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(ns, std::memory_order_relaxed);
+}
+
+auto histogram::count() const noexcept -> std::uint64_t
+{
+  return count_.load(std::memory_order_relaxed);
+}
+
+auto histogram::sum() const noexcept -> std::uint64_t
+{
+  return sum_.load(std::memory_order_relaxed);
+}
+
+auto histogram::quantile(double q) const noexcept -> std::uint64_t
+{
+  // the buckets are read once, since they may change meanwhile.
+  std::array<std::uint64_t, buckets> counts;
+  std::uint64_t total = 0;
+  for (std::size_t i = 0; i < buckets; ++i)
+    total += counts[i] = counts_[i].load(std::memory_order_relaxed);
+
+  if (total == 0)
+    return 0;
+
+  const auto rank = std::max<std::uint64_t>(
+    1, static_cast<std::uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(total))));
+
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < buckets; ++i)
+    if ((seen += counts[i]) >= rank)
+      return highest_of(i);
+  return highest_of(buckets - 1);
+}
+
+auto metrics::find(registry& r, std::string_view name) -> std::shared_ptr<histogram>
+{
+  const std::lock_guard lock(mutex_);
+  if (const auto it = r.find(name); it != r.end())
+    return it->second;
+  return r.emplace(std::string(name), std::make_shared<histogram>()).first->second;
+}
+
+auto metrics::chunk_latency(std::string_view name) -> std::shared_ptr<histogram>
+{
+  return find(chunks_, name);
+}
+
+auto metrics::function_latency(std::string_view name) -> std::shared_ptr<histogram>
+{
+  return find(functions_, name);
+}
+
+namespace
+{
+constexpr std::array quantiles{0.5, 0.99, 0.999};
+
+// independent of the C locale.
+auto number(double x) -> std::string
+{
+  char buffer[32];
+  const auto end = std::to_chars(buffer, buffer + sizeof(buffer), x, std::chars_format::general, 9);
+  return std::string(buffer, end.ptr);
+}
+
+auto seconds(std::uint64_t ns) -> std::string { return number(static_cast<double>(ns) / 1e9); }
+
+auto escape(std::string_view label) -> std::string
+{
+  std::string out;
+  for (const auto c : label) {
+    if (c == '\\' || c == '"')
+      out += '\\';
+    if (c == '\n')
+      out += "\\n";
+    else
+      out += c;
+  }
+  return out;
+}
+
+auto render(std::string& out, std::string_view metric, std::string_view label,
+            std::string_view help, const auto& registry) -> void
+{
+  if (registry.empty())
+    return;
+
+  out.append("# HELP ").append(metric).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(metric).append(" summary\n");
+
+  for (const auto& [name, h] : registry) {
+    const auto labels = std::string(label) + "=\"" + escape(name) + "\"";
+    for (const auto q : quantiles)
+      out.append(metric)
+        .append("{" + labels + ",quantile=\"" + number(q) + "\"} ")
+        .append(seconds(h->quantile(q)))
+        .append("\n");
+    out.append(metric).append("_sum{" + labels + "} ").append(seconds(h->sum())).append("\n");
+    out.append(metric)
+      .append("_count{" + labels + "} ")
+      .append(std::to_string(h->count()))
+      .append("\n");
+  }
+}
+} // namespace
+
+auto metrics::prometheus() const -> std::string
+{
+  // the histograms themselves are read without the lock, which only guards the names.
+  registry chunks;
+  registry functions;
+  {
+    const std::lock_guard lock(mutex_);
+    chunks = chunks_;
+    functions = functions_;
+  }
+
+  std::string out;
+  render(out, "luapp_chunk_duration_seconds", "chunk", "Latency of named Lua chunks.", chunks);
+  render(out, "luapp_function_duration_seconds", "function", "Latency of bound C++ functions.",
+         functions);
+  return out;
+}
+
+} // namespace lua
@@ -0,0 +1,105 @@
+#include <cassert>
+#include <new>
+
+#include <luapp/pairs.hpp>
+#include <luapp/state.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+// stack layout while iterating: [base_ + 1] table, [base_ + 2] key, [base_ + 3] value
+
+pairs::pairs(const table& t)
+  : sdata_(t.ref_.state()), state_(sdata_->state), base_(lua_gettop(state_))
+{
+  if (!detail::check_stack(state_, 3))
+    throw std::bad_alloc{};
+
+  t.push(*sdata_, state_);
+  lua_pushnil(state_);
+}
+
+pairs::~pairs() noexcept
+{
+  assert(lua_gettop(state_) >= base_ + 1);
+  lua_settop(state_, base_);
+}
+
+auto pairs::next() -> bool
+{
+  lua_settop(state_, base_ + 2);
+  return lua_next(state_, base_ + 1);
+}
+
+auto pairs::begin() -> iterator { return iterator(next() ? this : nullptr); }
+
+auto pairs::end() noexcept -> iterator { return iterator(nullptr); }
+
+pairs::iterator::iterator(pairs* range) noexcept : range_(range) {}
+
+auto pairs::iterator::operator*() const -> value_type
+{
+  assert(range_);
+  const auto& r = *range_;
+  return {value::at(*r.sdata_, r.state_, r.base_ + 2),
+          value::at(*r.sdata_, r.state_, r.base_ + 3)};
+}
+
+auto pairs::iterator::operator++() -> iterator&
+{
+  assert(range_);
+  if (!range_->next())
+    range_ = nullptr;
+  return *this;
+}
+
+// stack layout while iterating: [base_ + 1] table, [base_ + 2] value
+
+ipairs::ipairs(const table& t)
+  : sdata_(t.ref_.state()), state_(sdata_->state), base_(lua_gettop(state_))
+{
+  if (!detail::check_stack(state_, 2))
+    throw std::bad_alloc{};
+
+  t.push(*sdata_, state_);
+}
+
+ipairs::~ipairs() noexcept
+{
+  assert(lua_gettop(state_) >= base_ + 1);
+  lua_settop(state_, base_);
+}
+
+auto ipairs::next() -> bool
+{
+  lua_settop(state_, base_ + 1);
+  if (lua_geti(state_, base_ + 1, ++index_) != LUA_TNIL)
+    return true;
+
+  lua_pop(state_, 1);
+  return false;
+}
+
+auto ipairs::begin() -> iterator { return iterator(next() ? this : nullptr); }
+
+auto ipairs::end() noexcept -> iterator { return iterator(nullptr); }
+
+ipairs::iterator::iterator(ipairs* range) noexcept : range_(range) {}
+
+auto ipairs::iterator::operator*() const -> value_type
+{
+  assert(range_);
+  const auto& r = *range_;
+  return {r.index_, value::at(*r.sdata_, r.state_, r.base_ + 2)};
+}
+
+auto ipairs::iterator::operator++() -> iterator&
+{
+  assert(range_);
+  if (!range_->next())
+    range_ = nullptr;
+  return *this;
+}
+
+} // namespace lua
@@ -1,5 +1,6 @@
 #include <cassert>
 #include <new>
+#include <utility>
 
 extern "C" {
 #include <lauxlib.h>
@@ -11,40 +12,213 @@ extern "C" {
 namespace lua
 {
 
-reference::reference(std::shared_ptr<state_data> state_data, int index)
-  : data_(
-      new reference_data{state_data, index}, +[](reference_data* d) {
-        if (const auto state_data = d->sdata.lock())
-          luaL_unref(state_data->state, LUA_REGISTRYINDEX, d->index);
-        delete d;
-      })
+namespace
 {
-  if (!data_)
-    throw std::bad_alloc{};
+// `state_token::released` of closed states, whose slots need no unref.
+release_node closed_marker{};
+
+auto unown(state_token* token) noexcept -> void
+{
+  if (token->count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete token;
 }
 
-auto reference::valid() const noexcept -> bool
+auto is_owner(const state_token* token) noexcept -> bool
 {
-  return data_ && !data_->sdata.expired() && data_->index != LUA_NOREF;
+  return token->owner == std::this_thread::get_id() &&
+         token->sdata.load(std::memory_order_relaxed);
 }
 
-reference::operator bool() const noexcept { return valid(); }
+auto add_ref(reference_data* d) noexcept -> void
+{
+  if (d->token->released.load(std::memory_order_acquire) != &closed_marker)
+    ++d->count;
+  else
+    std::atomic_ref(d->count).fetch_add(1, std::memory_order_relaxed);
+}
+
+// the registry slot is gone with the state.
+auto free_closed(reference_data* d) noexcept -> void
+{
+  const auto token = d->token;
+  delete d;
+  unown(token);
+}
+
+// unrefs the slot of a handle released by the owner, or by another thread.
+auto free_open(state_data& sdata, reference_data* d) noexcept -> void
+{
+  luaL_unref(sdata.state, LUA_REGISTRYINDEX, d->index);
+  LUAPP_STAT(++sdata.stats.refs_released);
+  if (sdata.memory.track_cpp)
+    sdata.memory.credit(sizeof(reference_data));
+  free_closed(d);
+}
+} // namespace
+
+reference::reference(state_data& sdata, int index)
+{
+  collect(sdata);
+
+  try {
+    data_ = new reference_data{sdata.token, index, 1, nullptr};
+  } catch (...) {
+    luaL_unref(sdata.state, LUA_REGISTRYINDEX, index);
+    throw;
+  }
+
+  sdata.token->count.fetch_add(1, std::memory_order_relaxed);
+  LUAPP_STAT(++sdata.stats.refs_created);
+
+  if (sdata.memory.track_cpp)
+    sdata.memory.charge(sizeof(reference_data));
+}
+
+reference::~reference() noexcept { release(); }
+
+reference::reference(const reference& other) noexcept : data_(other.data_)
+{
+  if (data_)
+    add_ref(data_);
+}
+
+reference::reference(reference& other) noexcept : reference(std::as_const(other)) {}
+
+reference::reference(reference&& other) noexcept : data_(std::exchange(other.data_, nullptr)) {}
+
+auto reference::operator=(const reference& other) noexcept -> reference&
+{
+  if (other.data_)
+    add_ref(other.data_);
+  release();
+  data_ = other.data_;
+  return *this;
+}
+
+auto reference::operator=(reference& other) noexcept -> reference&
+{
+  return *this = std::as_const(other);
+}
 
-auto reference::push(std::shared_ptr<state_data> s) const -> int
+auto reference::operator=(reference&& other) noexcept -> reference&
 {
-  const auto state = s->state;
-  return push(std::move(s), state);
+  if (this != &other) {
+    release();
+    data_ = std::exchange(other.data_, nullptr);
+  }
+  return *this;
 }
 
-auto reference::push(std::shared_ptr<state_data> s, lua_State* state) const -> int
+auto reference::release() noexcept -> void
 {
-  if (!lua_checkstack(state, 1))
+  const auto d = std::exchange(data_, nullptr);
+  if (!d)
+    return;
+
+  const auto token = d->token;
+  if (is_owner(token)) {
+    if (--d->count == 0) {
+      d->next = token->dead;
+      token->dead = d;
+    }
+    return;
+  }
+
+  auto& released = token->released;
+  auto head = released.load(std::memory_order_acquire);
+  if (head != &closed_marker) {
+    // should this fail, the slot is only reclaimed with the state.
+    const auto n = new (std::nothrow) release_node{d, head};
+    if (!n)
+      return;
+
+    while (n->next != &closed_marker)
+      if (released.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                         std::memory_order_acquire))
+        return;
+    delete n;
+  }
+
+  // the state is gone, and any thread may hold the last copy.
+  if (std::atomic_ref(d->count).fetch_sub(1, std::memory_order_acq_rel) == 1)
+    free_closed(d);
+}
+
+auto reference::collect(state_data& sdata) noexcept -> void
+{
+  const auto token = sdata.token;
+
+  while (const auto d = token->dead) {
+    token->dead = d->next;
+    free_open(sdata, d);
+  }
+
+  // a relaxed load keeps the common case, nothing to collect, free of atomic writes.
+  if (!token->released.load(std::memory_order_relaxed))
+    return;
+
+  auto n = token->released.exchange(nullptr, std::memory_order_acquire);
+  assert(n != &closed_marker);
+
+  while (n) {
+    const auto d = n->data;
+    delete std::exchange(n, n->next);
+    if (--d->count == 0)
+      free_open(sdata, d);
+  }
+}
+
+auto reference::close(state_token* token) noexcept -> void
+{
+  token->sdata.store(nullptr, std::memory_order_release);
+
+  while (const auto d = token->dead) {
+    token->dead = d->next;
+    free_closed(d);
+  }
+
+  // the releases queued until the marker is in place are applied here, the later ones by the
+  // threads making them.
+  for (;;) {
+    auto n = token->released.exchange(nullptr, std::memory_order_acquire);
+    if (!n) {
+      if (token->released.compare_exchange_strong(n, &closed_marker, std::memory_order_acq_rel))
+        break;
+      continue;
+    }
+
+    while (n) {
+      const auto d = n->data;
+      delete std::exchange(n, n->next);
+      if (--d->count == 0)
+        free_closed(d);
+    }
+  }
+
+  unown(token);
+}
+
+auto reference::valid() const noexcept -> bool
+{
+  return data_ && data_->token->sdata.load(std::memory_order_acquire) && data_->index != LUA_NOREF;
+}
+
+reference::operator bool() const noexcept { return valid(); }
+
+auto reference::push(state_data& s) const -> int { return push(s, s.state); }
+
+auto reference::push(state_data&, lua_State* state) const -> int
+{
+  if (!detail::check_stack(state, 1))
     throw std::bad_alloc{};
 
   // assumes that LUA_REGISTRYINDEX is shared
   return lua_rawgeti(state, LUA_REGISTRYINDEX, data_->index);
 }
 
-auto reference::state() const -> std::shared_ptr<state_data> { return data_->sdata.lock(); }
+auto reference::state() const noexcept -> state_data*
+{
+  return data_ ? data_->token->sdata.load(std::memory_order_acquire) : nullptr;
+}
 
 } // namespace lua
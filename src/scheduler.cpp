@@ -0,0 +1,179 @@
+#include <coroutine>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <utility>
+
+#include <luapp/scheduler.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+// A self-destroying coroutine that owns a spawned task and reports its exception.
+struct scheduler::root
+{
+  struct promise_type
+  {
+    scheduler* sched;
+    std::list<std::coroutine_handle<>>::iterator it;
+
+    promise_type(scheduler& s, task<void>&) : sched(&s)
+    {
+      it = sched->roots_.insert(sched->roots_.end(),
+                                std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    ~promise_type() { sched->roots_.erase(it); }
+
+    auto get_return_object() noexcept -> root { return {}; }
+    auto initial_suspend() noexcept -> std::suspend_always
+    {
+      sched->ready_.push_back(*it);
+      return {};
+    }
+    auto final_suspend() noexcept -> std::suspend_never { return {}; }
+    auto return_void() noexcept -> void {}
+    auto unhandled_exception() noexcept -> void
+    {
+      if (!sched->error_)
+        sched->error_ = std::current_exception();
+    }
+  };
+
+  static auto run(scheduler&, task<void> t) -> root { co_await std::move(t); }
+};
+
+scheduler::~scheduler() noexcept
+{
+  while (!roots_.empty())
+    roots_.front().destroy();
+}
+
+auto scheduler::spawn(task<void> t) -> void { root::run(*this, std::move(t)); }
+
+auto scheduler::run() -> void
+{
+  while (true) {
+    run_ready();
+    if (roots_.empty())
+      break;
+    wake_up(true);
+  }
+
+  if (error_)
+    std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+auto scheduler::poll() -> void
+{
+  run_ready();
+
+  if (error_)
+    std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+auto scheduler::run_ready() -> void
+{
+  wake_up(false);
+  while (!ready_.empty()) {
+    const auto h = ready_.front();
+    ready_.pop_front();
+    h.resume();
+  }
+}
+
+// Moves posted coroutines and expired timers to the ready queue, waiting for one if asked to.
+auto scheduler::wake_up(bool wait) -> void
+{
+  {
+    std::unique_lock lock(posted_mutex_);
+    if (wait) {
+      const auto posted = [this] { return !posted_.empty(); };
+      if (timers_.empty())
+        posted_cv_.wait(lock, posted);
+      else
+        posted_cv_.wait_until(lock, timers_.top().deadline, posted);
+    }
+    ready_.insert(ready_.end(), posted_.begin(), posted_.end());
+    posted_.clear();
+  }
+
+  const auto now = clock::now();
+  while (!timers_.empty() && timers_.top().deadline <= now) {
+    ready_.push_back(timers_.top().h);
+    timers_.pop();
+  }
+}
+
+auto scheduler::size() const noexcept -> std::size_t { return roots_.size(); }
+
+auto scheduler::resume(thread co, tuple args) -> task<tuple>
+{
+  co_await yield();
+
+  while (true) {
+    tuple r;
+    const auto previous = std::exchange(driving_, co.get());
+    try {
+      r = co.resume(std::move(args));
+    } catch (...) {
+      driving_ = previous;
+      pending_.reset();
+      throw;
+    }
+    driving_ = previous;
+
+    if (!pending_)
+      co_return r;
+
+    // the coroutine called an async function: its results, or error, are given back to it.
+    auto op = std::move(*pending_);
+    pending_.reset();
+    try {
+      r = co_await std::move(op);
+      tuple next;
+      next.resize(r.size() + 1);
+      next[0] = boolean{true};
+      for (std::size_t i = 0; i < r.size(); ++i)
+        next[i + 1] = std::move(r[i]);
+      args = std::move(next);
+    } catch (const std::exception& e) {
+      args = tuple{boolean{false}, string(e.what())};
+    }
+  }
+}
+
+auto scheduler::resume(thread co) -> task<tuple> { return resume(std::move(co), tuple{}); }
+
+auto scheduler::yield() noexcept -> yield_awaiter { return yield_awaiter{*this}; }
+
+auto scheduler::sleep_for(clock::duration d) noexcept -> sleep_awaiter
+{
+  return sleep_until(clock::now() + d);
+}
+
+auto scheduler::sleep_until(clock::time_point t) noexcept -> sleep_awaiter { return {*this, t}; }
+
+auto scheduler::schedule(std::coroutine_handle<> h) -> void { ready_.push_back(h); }
+
+auto scheduler::post(std::coroutine_handle<> h) -> void
+{
+  {
+    const std::lock_guard lock(posted_mutex_);
+    posted_.push_back(h);
+  }
+  posted_cv_.notify_one();
+}
+
+auto scheduler::finish(lua_State* state, int, lua_KContext nargs) -> int
+{
+  const auto ok = static_cast<int>(nargs) + 1;
+  if (!lua_toboolean(state, ok)) {
+    lua_pushvalue(state, ok + 1);
+    return lua_error(state);
+  }
+  return lua_gettop(state) - ok;
+}
+
+} // namespace lua
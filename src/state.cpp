@@ -1,9 +1,19 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <new>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 extern "C" {
 #include <lauxlib.h>
@@ -20,17 +30,211 @@ extern "C" {
 namespace lua
 {
 
-state::state(options opt)
+namespace
+{
+auto evict(chunk_cache& cache) -> void
+{
+  while (cache.entries.size() > cache.capacity) {
+    cache.index.erase(cache.entries.back().hash);
+    cache.entries.pop_back();
+  }
+}
+
+auto reallocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize) -> void*
+{
+  auto& data = *static_cast<state_data*>(ud);
+  auto& memory = data.memory;
+
+  // when ptr is null, osize encodes the type of the object being created.
+  if (!ptr)
+    osize = 0;
+
+  if (nsize > osize && memory.limit != 0 && memory.protected_calls != 0 &&
+      memory.usage + (nsize - osize) > memory.limit) {
+    memory.refused = true;
+    return nullptr;
+  }
+
+  void* p = nullptr;
+  if (data.alloc)
+    p = data.alloc->reallocate(ptr, osize, nsize);
+  else if (nsize == 0)
+    std::free(ptr);
+  else
+    p = std::realloc(ptr, nsize);
+
+  if (p || nsize == 0) {
+    memory.credit(osize);
+    memory.charge(nsize);
+  }
+
+  return p;
+}
+
+// Instructions between checks of a time budget.
+constexpr std::size_t time_check_interval = 1000;
+
+auto budget_message(const budget_account& budget) -> const char*
+{
+  return budget.limit.instructions != 0 && budget.used >= budget.limit.instructions
+           ? "instruction budget exceeded"
+           : "time budget exceeded";
+}
+
+auto hook(lua_State* state, lua_Debug*) -> void;
+
+// The hook is shared by the budget and the profiler, and runs as often as the most demanding.
+auto install_hook(state_data& sdata, lua_State* state) noexcept -> void
+{
+  const auto& budget = sdata.budget;
+  const auto& profiler = sdata.profiler;
+
+  if (!budget.active && !profiler.active) {
+    lua_sethook(state, nullptr, 0, 0);
+    return;
+  }
+
+  auto count = INT_MAX;
+  if (budget.active)
+    count = budget.exceeded ? 1 : budget.step;
+  if (profiler.active)
+    count = std::min(count, profiler.interval);
+  lua_sethook(state, hook, LUA_MASKCOUNT, count);
+}
+
+// Names a frame as flame graph tools expect, without the separators of the folded format.
+auto frame_name(lua_State* state, lua_Debug& ar) -> std::string
+{
+  // functions called from C++ have no name, but are told apart by their definition.
+  std::string name = ar.name ? ar.name : "";
+  if (*ar.what == 'C') {
+    const std::string tag = detail::is_cpp_function(state, -1) ? "[C++]" : "[C]";
+    name = name.empty() ? tag : name + " " + tag;
+  } else {
+    const auto where = std::string(ar.short_src) +
+                       (*ar.what == 'm' ? "" : ":" + std::to_string(ar.linedefined));
+    name += name.empty() ? "(" + where + ")" : " (" + where + ")";
+  }
+
+  for (auto& c : name)
+    if (c == ';' || c == '\n')
+      c = ' ';
+  return name;
+}
+
+auto sample(state_data& sdata, lua_State* state) -> void
+{
+  std::vector<std::string> frames;
+  lua_Debug ar;
+  for (int level = 0; lua_getstack(state, level, &ar); ++level) {
+    lua_getinfo(state, "Snf", &ar);
+    frames.push_back(frame_name(state, ar));
+    lua_pop(state, 1);
+  }
+
+  std::string stack;
+  for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+    if (!stack.empty())
+      stack += ';';
+    stack += *it;
+  }
+  ++sdata.profiler.stacks[std::move(stack)];
+}
+
+auto hook(lua_State* state, lua_Debug*) -> void
+{
+  auto& sdata = detail::state_of(state);
+  auto& budget = sdata.budget;
+  auto& profiler = sdata.profiler;
+
+  // left behind on a coroutine by a call or a profiler that has finished.
+  if (!budget.active && !profiler.active) {
+    lua_sethook(state, nullptr, 0, 0);
+    return;
+  }
+
+  const auto count = lua_gethookcount(state);
+
+  if (profiler.active) {
+    profiler.countdown -= count;
+    if (profiler.countdown <= 0) {
+      profiler.countdown += profiler.interval;
+      try {
+        sample(sdata, state);
+      } catch (...) {
+        // a sample that cannot be taken is dropped.
+      }
+    }
+  }
+
+  if (!budget.active)
+    return;
+
+  if (!budget.exceeded) {
+    budget.used += static_cast<std::size_t>(count);
+    const auto& limit = budget.limit;
+    budget.exceeded =
+      (limit.instructions != 0 && budget.used >= limit.instructions) ||
+      (limit.time != std::chrono::steady_clock::duration{} &&
+       std::chrono::steady_clock::now() >= budget.deadline);
+    if (!budget.exceeded)
+      return;
+
+    // scripts catching the error run out again at their next instruction.
+    install_hook(sdata, state);
+  }
+
+  if (state != sdata.state && lua_isyieldable(state)) {
+    lua_yield(state, 0);
+    return;
+  }
+
+  lua_pushstring(state, budget_message(budget));
+  lua_error(state);
+}
+
+// same as luaL_newstate's
+auto panic(lua_State* state) -> int
+{
+  const auto* msg = lua_tostring(state, -1);
+  std::fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", msg ? msg : "?");
+  std::fflush(stderr);
+  return 0;
+}
+} // namespace
+
+state::state(options opt) : state(nullptr, opt) {}
+
+state::state(std::shared_ptr<allocator> alloc, options opt)
   : data_(
-      new state_data{luaL_newstate(), {}}, +[](state_data* data) {
-        assert(lua_gettop(data->state) == 0);
-        lua_close(data->state);
+      new state_data{nullptr, {}, {}, std::move(alloc), {}, {}, {}, nullptr, nullptr,
+                     LUA_NOREF LUAPP_STAT(, {})},
+      +[](state_data* data) {
+        if (data->state) {
+          assert(lua_gettop(data->state) == 0);
+          lua_close(data->state);
+        }
+
+        // references held by the state itself are released without touching the closed state.
+        if (data->token)
+          reference::close(data->token);
+
         delete data;
       })
 {
-  if (!data_ || !data_->state)
+  if (!data_)
     throw std::bad_alloc{};
 
+  data_->token = new state_token{data_.get(), 1, std::this_thread::get_id(), nullptr, nullptr};
+
+  data_->memory.track_cpp = opt & options::track_cpp_memory;
+
+  data_->state = lua_newstate(reallocate, data_.get());
+  if (!data_->state)
+    throw std::bad_alloc{};
+
+  lua_atpanic(data_->state, panic);
+
   const auto state = data_->state;
 
   if (opt & options::std_libs)
@@ -51,11 +255,12 @@ state::state(options opt)
   {
     push_gc_table(
       "__luapp_userdata", +[](lua_State* state) -> int {
-        auto* p = reinterpret_cast<std::any*>(lua_touserdata(state, -1));
-        p->~any();
+        auto& sdata = detail::state_of(state);
+        userdata::finalize(sdata, *static_cast<userdata::header*>(lua_touserdata(state, -1)));
+        LUAPP_STAT(++sdata.stats.userdata_finalized);
         return 0;
       });
-    reference ref(data_, luaL_ref(state, LUA_REGISTRYINDEX));
+    reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
     data_->metatables.insert_or_assign(typeid(void), table(std::move(ref)));
   }
 
@@ -67,20 +272,31 @@ state::state(options opt)
         p->~fn_t();
         return 0;
       });
-    reference ref(data_, luaL_ref(state, LUA_REGISTRYINDEX));
+    reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
     data_->metatables.insert_or_assign(typeid(fn_t), table(std::move(ref)));
   }
 
   {
-    using weak_state = std::weak_ptr<state_data>;
+    // pushing a C++ function again reuses its closure while Lua still holds it.
+    lua_createtable(state, 0, 0);
+    lua_createtable(state, 0, 1);
+    lua_pushstring(state, "__mode");
+    lua_pushstring(state, "v");
+    lua_rawset(state, -3);
+    lua_setmetatable(state, -2);
+    data_->functions = luaL_ref(state, LUA_REGISTRYINDEX);
+  }
+
+  {
+    using target_t = std::shared_ptr<void>;
     push_gc_table(
-      "__luapp_weakstate", +[](lua_State* state) -> int {
-        auto* p = reinterpret_cast<weak_state*>(lua_touserdata(state, -1));
-        p->~weak_state();
+      "__luapp_function", +[](lua_State* state) -> int {
+        auto* p = reinterpret_cast<target_t*>(lua_touserdata(state, -1));
+        p->~target_t();
         return 0;
       });
-    reference ref(data_, luaL_ref(state, LUA_REGISTRYINDEX));
-    data_->metatables.insert_or_assign(typeid(weak_state), table(std::move(ref)));
+    reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
+    data_->metatables.insert_or_assign(typeid(target_t), table(std::move(ref)));
   }
 }
 
@@ -88,29 +304,37 @@ auto state::global_table() const -> table
 {
   const auto state = data_->state;
 
-  if (!lua_checkstack(state, 1))
+  if (!detail::check_stack(state, 1))
     throw std::bad_alloc{};
 
   lua_pushglobaltable(state);
-  reference ref(data_, luaL_ref(state, LUA_REGISTRYINDEX));
+  reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
 
   return table(std::move(ref));
 }
 
-auto state::do_string(const char* code) const -> tuple
+auto state::do_string(const char* code, const char* chunkname) const -> tuple
 {
   const auto state = data_->state;
-  if (!lua_checkstack(state, 1))
+  if (!detail::check_stack(state, 1))
     throw std::bad_alloc{};
 
+  reference::collect(*data_);
+
   const auto last_top = lua_gettop(state);
 
-  if (luaL_loadstring(state, code) || lua_pcall(state, 0, LUA_MULTRET, 0)) {
+  std::shared_ptr<histogram> latency;
+  if (push_chunk(code, chunkname, latency)) {
     std::string error = lua_tostring(state, -1);
     lua_pop(state, 1);
     throw std::runtime_error{std::move(error)};
   }
 
+  {
+    const detail::latency_timer timer(latency.get());
+    detail::pcall(*data_, 0);
+  }
+
   const auto n = lua_gettop(state) - last_top;
   COOL_DEFER(lua_pop(state, n));
 
@@ -118,14 +342,335 @@ auto state::do_string(const char* code) const -> tuple
   result.resize(n);
 
   for (const auto i : cool::closed_indices(1, n))
-    result[i - 1] = value::at(data_, last_top + i);
+    result[i - 1] = value::at(*data_, last_top + i);
 
   return result;
 }
 
-auto state::get_metatable(std::type_index key) const -> const table&
+namespace
+{
+// Histogram of the chunk at the top of the stack, under its chunk name; chunks loaded without a
+// name are labeled by their source, shortened as in Lua error messages.
+auto chunk_latency(state_data& sdata, lua_State* state) -> std::shared_ptr<histogram>
+{
+  if (!detail::check_stack(state, 1))
+    return nullptr;
+
+  lua_Debug ar;
+  lua_pushvalue(state, -1);
+  lua_getinfo(state, ">S", &ar);
+
+  std::string_view name = ar.source;
+  if (name.starts_with('=') || name.starts_with('@'))
+    name.remove_prefix(1);
+  else if (name.size() >= LUA_IDSIZE || name.find('\n') != name.npos)
+    name = ar.short_src;
+  return sdata.metrics->chunk_latency(name);
+}
+
+// The name Lua shows for a chunk loaded from a string, such as `[string "return 1"]`: the first
+// line of the source, truncated to fit `LUA_IDSIZE`.
+auto short_source(std::string_view code) -> std::string
+{
+  constexpr auto room = LUA_IDSIZE - sizeof("[string \"...\"]");
+  const auto line = code.substr(0, code.find('\n'));
+  if (line.size() == code.size() && code.size() < room)
+    return "[string \"" + std::string(code) + "\"]";
+  return "[string \"" + std::string(line.substr(0, room)) + "...\"]";
+}
+
+auto load_source(lua_State* state, const char* code, const char* chunkname) -> int
+{
+  return chunkname ? luaL_loadbuffer(state, code, std::strlen(code), chunkname)
+                   : luaL_loadstring(state, code);
+}
+} // namespace
+
+auto state::push_chunk(const char* code, const char* chunkname,
+                       std::shared_ptr<histogram>& latency) const -> int
 {
-  auto& mt = data_->metatables;
+  const auto state = data_->state;
+  auto& cache = data_->chunks;
+
+  // of the chunk at the top, unless already known.
+  const auto resolve = [&](std::shared_ptr<histogram>& h) {
+    if (data_->metrics && chunkname && !h)
+      h = chunk_latency(*data_, state);
+    latency = h;
+  };
+
+  if (cache.capacity == 0) {
+    LUAPP_STAT(++data_->stats.compilations);
+    const auto status = load_source(state, code, chunkname);
+    if (status == LUA_OK)
+      resolve(latency);
+    return status;
+  }
+
+  // the name is part of the key, since error messages and tracebacks report it.
+  const std::string_view source(code);
+  const auto name = chunkname ? std::optional<std::string_view>(chunkname) : std::nullopt;
+  auto hash = std::hash<std::string_view>{}(source);
+  if (name)
+    hash ^= std::hash<std::string_view>{}(*name) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+  const auto it = cache.index.find(hash);
+  if (it != cache.index.end() && it->second->source == source && it->second->name == name) {
+    ++cache.hits;
+    cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+    it->second->ref.push(*data_);
+    resolve(it->second->latency);
+    return LUA_OK;
+  }
+
+  ++cache.misses;
+  LUAPP_STAT(++data_->stats.compilations);
+  if (const auto status = load_source(state, code, chunkname); status != LUA_OK)
+    return status;
+
+  lua_pushvalue(state, -1);
+  reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
+
+  if (it != cache.index.end()) { // hash collision: the newest wins.
+    cache.entries.erase(it->second);
+    cache.index.erase(it);
+  }
+
+  cache.entries.push_front(
+    {hash, std::string(source), name ? std::optional<std::string>(*name) : std::nullopt,
+     std::move(ref), nullptr});
+  resolve(cache.entries.front().latency);
+  cache.index.insert_or_assign(hash, cache.entries.begin());
+  evict(cache);
+
+  return LUA_OK;
+}
+
+auto state::load(const char* code, const char* chunkname) const -> chunk
+{
+  const auto state = data_->state;
+  if (!detail::check_stack(state, 1))
+    throw std::bad_alloc{};
+
+  if (chunkname)
+    return pop_chunk(luaL_loadbufferx(state, code, std::strlen(code), chunkname, "t"), chunkname);
+
+  // named as Lua would, without keeping the whole source as its name.
+  auto name = short_source(code);
+  const auto status = luaL_loadbufferx(state, code, std::strlen(code), ("=" + name).c_str(), "t");
+  return pop_chunk(status, std::move(name));
+}
+
+auto state::load_binary(std::span<const std::byte> code, const char* chunkname) const -> chunk
+{
+  const auto state = data_->state;
+  if (!detail::check_stack(state, 1))
+    throw std::bad_alloc{};
+
+  const auto* p = reinterpret_cast<const char*>(code.data());
+  return pop_chunk(luaL_loadbufferx(state, p, code.size(), chunkname, "b"), chunkname);
+}
+
+auto state::load_file(const char* filename) const -> chunk
+{
+  const auto state = data_->state;
+  if (!detail::check_stack(state, 1))
+    throw std::bad_alloc{};
+
+  return pop_chunk(luaL_loadfilex(state, filename, "bt"), filename);
+}
+
+auto state::pop_chunk(int status, std::string name) const -> chunk
+{
+  const auto state = data_->state;
+
+  if (status != LUA_OK) {
+    std::string error = lua_tostring(state, -1);
+    lua_pop(state, 1);
+    throw std::runtime_error{std::move(error)};
+  }
+
+  auto latency = data_->metrics ? chunk_latency(*data_, state) : nullptr;
+  reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
+  return chunk(std::move(ref), std::move(name), std::move(latency));
+}
+
+auto state::set_chunk_cache(std::size_t capacity) const -> void
+{
+  data_->chunks.capacity = capacity;
+  evict(data_->chunks);
+}
+
+auto state::chunk_cache_stats() const noexcept -> lua::chunk_cache_stats
+{
+  const auto& cache = data_->chunks;
+  return {cache.hits, cache.misses, cache.entries.size(), cache.capacity};
+}
+
+auto state::collect_refs() const noexcept -> void { reference::collect(*data_); }
+
+auto state::memory_usage() const noexcept -> std::size_t { return data_->memory.usage; }
+
+auto state::memory_peak() const noexcept -> std::size_t { return data_->memory.peak; }
+
+auto state::reset_memory_peak() const noexcept -> void
+{
+  data_->memory.peak = data_->memory.usage;
+}
+
+auto state::set_memory_limit(std::size_t limit) const noexcept -> void
+{
+  data_->memory.limit = limit;
+}
+
+auto state::memory_limit() const noexcept -> std::size_t { return data_->memory.limit; }
+
+auto detail::state_of(lua_State* state) noexcept -> state_data&
+{
+  void* ud;
+  lua_getallocf(state, &ud);
+  return *static_cast<state_data*>(ud);
+}
+
+auto state::metrics() const -> std::shared_ptr<lua::metrics>
+{
+  if (!data_->metrics)
+    data_->metrics = std::make_shared<lua::metrics>();
+  return data_->metrics;
+}
+
+auto state::stats() const noexcept -> state_stats
+{
+#ifdef LUAPP_STATS
+  return data_->stats;
+#else
+  return {};
+#endif
+}
+
+#ifdef LUAPP_STATS
+auto detail::check_stack(lua_State* state, int n) -> bool
+{
+  // the stack is only reallocated when it is short.
+  auto& sdata = state_of(state);
+  const auto usage = sdata.memory.usage;
+  const auto ok = lua_checkstack(state, n);
+  if (sdata.memory.usage != usage)
+    ++sdata.stats.stack_growths;
+  return ok;
+}
+
+auto detail::count_string(state_data& sdata, std::size_t size) noexcept -> void
+{
+  ++sdata.stats.strings_copied;
+  sdata.stats.string_bytes += size;
+}
+#endif
+
+auto state::set_budget(lua::budget b) const noexcept -> void { data_->budget.limit = b; }
+
+auto state::start_profiler(std::size_t interval) const -> void
+{
+  auto& profiler = data_->profiler;
+  profiler.interval = static_cast<int>(std::clamp<std::size_t>(interval, 1, INT_MAX));
+  profiler.countdown = profiler.interval;
+  profiler.stacks.clear();
+  profiler.active = true;
+  install_hook(*data_, data_->state);
+}
+
+auto state::stop_profiler() const noexcept -> void
+{
+  data_->profiler.active = false;
+  install_hook(*data_, data_->state);
+}
+
+auto state::folded_profile() const -> std::string
+{
+  std::string out;
+  for (const auto& [stack, samples] : data_->profiler.stacks) {
+    out += stack;
+    out += ' ';
+    out += std::to_string(samples);
+    out += '\n';
+  }
+  return out;
+}
+
+auto state::budget() const noexcept -> lua::budget { return data_->budget.limit; }
+
+auto detail::enter(state_data& sdata, lua_State* state) noexcept -> void
+{
+  auto& budget = sdata.budget;
+
+  if (sdata.memory.protected_calls++ == 0) {
+    sdata.memory.refused = false;
+
+    const auto& limit = budget.limit;
+    budget.exceeded = false;
+    budget.active =
+      limit.instructions != 0 || limit.time != std::chrono::steady_clock::duration{};
+
+    if (budget.active) {
+      auto step = limit.instructions != 0 ? limit.instructions : time_check_interval;
+      if (limit.time != std::chrono::steady_clock::duration{}) {
+        step = std::min(step, time_check_interval);
+        budget.deadline = std::chrono::steady_clock::now() + limit.time;
+      }
+      budget.step = static_cast<int>(std::min<std::size_t>(step, INT_MAX));
+      budget.used = 0;
+    }
+  }
+
+  if (budget.active || sdata.profiler.active)
+    install_hook(sdata, state);
+}
+
+auto detail::leave(state_data& sdata, lua_State* state) noexcept -> void
+{
+  if (--sdata.memory.protected_calls == 0 && sdata.budget.active) {
+    sdata.budget.active = false;
+    install_hook(sdata, state);
+    install_hook(sdata, sdata.state);
+  }
+}
+
+auto detail::is_memory_error(const state_data& sdata, int status, const char* message) noexcept
+  -> bool
+{
+  if (status == LUA_ERRMEM)
+    return true;
+  return status == LUA_ERRRUN && sdata.memory.refused && message &&
+         std::strstr(message, "not enough memory");
+}
+
+auto detail::pcall(state_data& sdata, int nargs) -> void
+{
+  const auto state = sdata.state;
+
+  enter(sdata, state);
+  const auto status = lua_pcall(state, nargs, LUA_MULTRET, 0);
+  const auto exceeded = sdata.budget.exceeded;
+  leave(sdata, state);
+
+  if (status == LUA_OK)
+    return;
+
+  if (is_memory_error(sdata, status, lua_tostring(state, -1))) {
+    lua_pop(state, 1);
+    throw std::bad_alloc{};
+  }
+
+  std::string error = lua_tostring(state, -1);
+  lua_pop(state, 1);
+  if (exceeded)
+    throw budget_exceeded{budget_message(sdata.budget)};
+  throw std::runtime_error{std::move(error)};
+}
+
+auto detail::metatable_of(state_data& sdata, std::type_index key) -> const table&
+{
+  auto& mt = sdata.metatables;
 
   if (const auto it = mt.find(key); it != mt.end())
     return it->second;
@@ -138,7 +683,37 @@ auto state::create_table() const -> table
 {
   const auto state = data_->state;
   lua_createtable(state, 0, 0);
-  reference ref(data_, luaL_ref(state, LUA_REGISTRYINDEX));
+  return pop_table();
+}
+
+auto state::create_key(std::string_view name) const -> key
+{
+  const auto state = data_->state;
+  if (!detail::check_stack(state, 1))
+    throw std::bad_alloc{};
+
+  const auto* p = lua_pushlstring(state, name.data(), name.size());
+  reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
+  return key(std::move(ref), {p, name.size()});
+}
+
+auto state::create_thread(const function& f) const -> thread
+{
+  const auto state = data_->state;
+  if (!detail::check_stack(state, 1))
+    throw std::bad_alloc{};
+
+  const auto co = lua_newthread(state);
+  reference ref(*data_, luaL_ref(state, LUA_REGISTRYINDEX));
+
+  f.push(*data_, co);
+  return thread(std::move(ref));
+}
+
+auto state::pop_table() const -> table
+{
+  assert(lua_type(data_->state, -1) == LUA_TTABLE);
+  reference ref(*data_, luaL_ref(data_->state, LUA_REGISTRYINDEX));
   return table(std::move(ref));
 }
 
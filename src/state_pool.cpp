@@ -0,0 +1,240 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <latch>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <luapp/state_pool.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+namespace
+{
+using job = std::function<void(const state&)>;
+
+// A deque per worker: the owner takes its newest job, thieves take the oldest.
+struct worker
+{
+  std::mutex mutex;
+  std::deque<job> jobs;
+};
+} // namespace
+
+struct state_pool::data
+{
+  std::vector<std::unique_ptr<worker>> workers;
+  std::vector<std::thread> threads;
+
+  std::atomic<std::size_t> pending = 0; // queued jobs, counted before being pushed
+  std::atomic<std::size_t> next = 0;    // round-robin target of external submissions
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  std::mutex setup_mutex;
+  std::exception_ptr setup_error;
+
+  auto take(std::size_t self, job& j) -> bool
+  {
+    const auto n = workers.size();
+    for (std::size_t k = 0; k < n; ++k) {
+      auto& w = *workers[(self + k) % n];
+      const std::lock_guard lock(w.mutex);
+      if (w.jobs.empty())
+        continue;
+
+      if (k == 0) {
+        j = std::move(w.jobs.back());
+        w.jobs.pop_back();
+      } else {
+        j = std::move(w.jobs.front());
+        w.jobs.pop_front();
+      }
+      pending.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  auto run(std::size_t self, const setup_function& setup, state::options opt, std::latch& ready)
+    -> void;
+};
+
+namespace
+{
+// The pool and index of the worker running on this thread, if any.
+thread_local const void* current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+} // namespace
+
+auto state_pool::data::run(std::size_t self, const setup_function& setup, state::options opt,
+                           std::latch& ready) -> void
+{
+  current_pool = this;
+  current_worker = self;
+
+  std::optional<state> s;
+  try {
+    s.emplace(opt);
+    if (setup)
+      setup(*s);
+  } catch (...) {
+    const std::lock_guard lock(setup_mutex);
+    if (!setup_error)
+      setup_error = std::current_exception();
+  }
+  ready.count_down();
+
+  job j;
+  while (true) {
+    if (take(self, j)) {
+      if (s)
+        j(*s);
+      j = nullptr;
+      continue;
+    }
+
+    std::unique_lock lock(sleep_mutex);
+    wake.wait(lock, [&] { return stopping || pending.load() > 0; });
+    if (stopping && pending.load() == 0)
+      break;
+  }
+}
+
+state_pool::state_pool(std::size_t workers, setup_function setup, state::options opt)
+  : data_(std::make_unique<data>())
+{
+  if (workers == 0)
+    throw std::invalid_argument{"a state pool needs at least one worker"};
+
+  for (std::size_t i = 0; i < workers; ++i)
+    data_->workers.push_back(std::make_unique<worker>());
+
+  std::latch ready(static_cast<std::ptrdiff_t>(workers));
+  std::size_t started = 0;
+  try {
+    for (; started < workers; ++started)
+      data_->threads.emplace_back([this, started, &setup, opt, &ready] {
+        data_->run(started, setup, opt, ready);
+      });
+  } catch (...) {
+    ready.count_down(static_cast<std::ptrdiff_t>(workers - started));
+    stop();
+    throw;
+  }
+  ready.wait();
+
+  if (data_->setup_error) {
+    stop();
+    std::rethrow_exception(data_->setup_error);
+  }
+}
+
+state_pool::~state_pool() noexcept { stop(); }
+
+auto state_pool::stop() noexcept -> void
+{
+  {
+    const std::lock_guard lock(data_->sleep_mutex);
+    data_->stopping = true;
+  }
+  data_->wake.notify_all();
+
+  for (auto& t : data_->threads)
+    if (t.joinable())
+      t.join();
+}
+
+auto state_pool::size() const noexcept -> std::size_t { return data_->workers.size(); }
+
+auto state_pool::post(std::function<void(const state&)> j) -> void
+{
+  // jobs submitted by a worker stay on it, others are spread.
+  const auto n = data_->workers.size();
+  const auto target = current_pool == data_.get()
+                        ? current_worker
+                        : data_->next.fetch_add(1, std::memory_order_relaxed) % n;
+
+  data_->pending.fetch_add(1);
+  {
+    auto& w = *data_->workers[target];
+    const std::lock_guard lock(w.mutex);
+    w.jobs.push_back(std::move(j));
+  }
+
+  // taking the lock orders the notification after a worker has checked for jobs.
+  { const std::lock_guard lock(data_->sleep_mutex); }
+  data_->wake.notify_one();
+}
+
+auto state_pool::run(std::string code) -> std::future<tuple>
+{
+  return submit([code = std::move(code)](const state& s) {
+    return detail::detach(s.do_string(code.c_str()));
+  });
+}
+
+auto state_pool::run(std::string code, completion done) -> void
+{
+  post([code = std::move(code), done = std::move(done)](const state& s) {
+    tuple result;
+    try {
+      result = detail::detach(s.do_string(code.c_str()));
+    } catch (...) {
+      return done(std::current_exception(), tuple{});
+    }
+    done(nullptr, std::move(result));
+  });
+}
+
+namespace
+{
+auto call_global(const state& s, const std::string& name, const tuple& args) -> tuple
+{
+  const auto f = get(s.global_table(), name.c_str());
+  if (!f.is_function())
+    throw std::runtime_error{"no global function named " + name};
+
+  return detail::detach(std::get<function>(f.as_variant()).call(args));
+}
+} // namespace
+
+auto state_pool::call(std::string name, tuple args) -> std::future<tuple>
+{
+  return submit([name = std::move(name), args = detail::detach(std::move(args))](const state& s) {
+    return call_global(s, name, args);
+  });
+}
+
+auto state_pool::call(std::string name, tuple args, completion done) -> void
+{
+  post([name = std::move(name), args = detail::detach(std::move(args)),
+        done = std::move(done)](const state& s) {
+    tuple result;
+    try {
+      result = call_global(s, name, args);
+    } catch (...) {
+      return done(std::current_exception(), tuple{});
+    }
+    done(nullptr, std::move(result));
+  });
+}
+
+auto detail::detach(tuple t) -> tuple
+{
+  for (std::size_t i = 0; i < t.size(); ++i) {
+    const auto& v = t[i];
+    if (v.is_table() || v.is_function() || v.is_userdata() || v.is_thread())
+      throw std::runtime_error{"only nil, booleans, numbers and strings may cross states"};
+  }
+  return t;
+}
+
+} // namespace lua
@@ -15,12 +15,12 @@ namespace lua
 
 table::table(reference ref) noexcept : ref_(std::move(ref)) {}
 
-auto table::get(const value& key) const -> reference
+auto table::get(const value& key) const -> value
 {
-  const auto state_data = ref_.state();
-  const auto state = state_data->state;
+  auto& state_data = *ref_.state();
+  const auto state = state_data.state;
 
-  if (!lua_checkstack(state, 2))
+  if (!detail::check_stack(state, 2))
     throw std::bad_alloc{};
 
   push(state_data);
@@ -28,16 +28,18 @@ auto table::get(const value& key) const -> reference
 
   key.push(state_data);
   lua_gettable(state, -2);
+  COOL_DEFER(lua_pop(state, 1));
 
-  return reference(state_data, luaL_ref(state, LUA_REGISTRYINDEX));
+  // scalars are converted right away; only collectable objects need a registry reference.
+  return value::at(state_data, state, -1);
 }
 
 auto table::set(const value& key, const value& value) const -> void
 {
-  const auto state_data = ref_.state();
-  const auto state = state_data->state;
+  auto& state_data = *ref_.state();
+  const auto state = state_data.state;
 
-  if (!lua_checkstack(state, 3))
+  if (!detail::check_stack(state, 3))
     throw std::bad_alloc{};
 
   push(state_data);
@@ -48,29 +50,78 @@ auto table::set(const value& key, const value& value) const -> void
   lua_settable(state, -3);
 }
 
-auto table::push(std::shared_ptr<state_data> state_data) const -> int
+auto table::get(const key& k) const -> value
+{
+  auto& state_data = *ref_.state();
+  const auto state = state_data.state;
+  assert(&state_data == k.ref_.state());
+
+  if (!detail::check_stack(state, 2))
+    throw std::bad_alloc{};
+
+  push(state_data, state);
+  COOL_DEFER(lua_pop(state, 1));
+
+  k.push(state);
+  lua_gettable(state, -2);
+  COOL_DEFER(lua_pop(state, 1));
+
+  return value::at(state_data, state, -1);
+}
+
+auto table::set(const key& k, const value& value) const -> void
+{
+  auto& state_data = *ref_.state();
+  const auto state = state_data.state;
+  assert(&state_data == k.ref_.state());
+
+  if (!detail::check_stack(state, 3))
+    throw std::bad_alloc{};
+
+  push(state_data, state);
+  COOL_DEFER(lua_pop(state, 1));
+
+  k.push(state);
+  value.push(state_data, state);
+  lua_settable(state, -3);
+}
+
+auto table::push_array() const -> std::pair<lua_State*, std::size_t>
+{
+  auto& state_data = *ref_.state();
+  const auto state = state_data.state;
+
+  // the table and one element at a time.
+  if (!detail::check_stack(state, 2))
+    throw std::bad_alloc{};
+
+  push(state_data);
+  return {state, lua_rawlen(state, -1)};
+}
+
+auto table::push(state_data& state_data) const -> int
 {
-  const auto state = state_data->state;
-  return push(std::move(state_data), state);
+  const auto state = state_data.state;
+  return push(state_data, state);
 }
 
-auto table::push(std::shared_ptr<state_data> state_data, lua_State* state) const -> int
+auto table::push(state_data& state_data, lua_State* state) const -> int
 {
-  assert(state_data == ref_.state());
+  assert(&state_data == ref_.state());
 
-  if (!lua_checkstack(state, 1))
+  if (!detail::check_stack(state, 1))
     throw std::bad_alloc{};
 
-  ref_.push(std::move(state_data), state);
+  ref_.push(state_data, state);
   return LUA_TTABLE;
 }
 
 auto table::operator==(const table& other) const -> bool
 {
-  const auto sdata = ref_.state();
-  assert(sdata == other.ref_.state());
+  auto& sdata = *ref_.state();
+  assert(&sdata == other.ref_.state());
 
-  const auto state = sdata->state;
+  const auto state = sdata.state;
 
   push(sdata);
   COOL_DEFER(lua_pop(state, 1));
@@ -78,7 +129,7 @@ auto table::operator==(const table& other) const -> bool
   other.push(sdata);
   COOL_DEFER(lua_pop(state, 1));
 
-  return lua_compare(sdata->state, -1, -2, LUA_OPEQ);
+  return lua_compare(sdata.state, -1, -2, LUA_OPEQ);
 }
 
 auto table::operator!=(const table& other) const -> bool { return !(*this == other); }
@@ -0,0 +1,112 @@
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+#include <cool/defer.hpp>
+#include <cool/indices.hpp>
+#include <luapp/state.hpp>
+#include <luapp/thread.hpp>
+#include <luapp/value.hpp>
+
+namespace lua
+{
+
+thread::thread(reference ref) noexcept : ref_(std::move(ref)) {}
+
+auto thread::get() const -> lua_State*
+{
+  auto& sdata = *ref_.state();
+  const auto state = sdata.state;
+
+  push(sdata);
+  const auto co = lua_tothread(state, -1);
+  lua_pop(state, 1);
+  return co;
+}
+
+auto thread::resume() const -> tuple { return resume(tuple{}); }
+
+auto thread::resume(tuple args) const -> tuple
+{
+  auto& sdata = *ref_.state();
+  reference::collect(sdata);
+
+  const auto co = get();
+  if (status_of(co) != status::suspended)
+    throw std::runtime_error{"cannot resume non-suspended coroutine"};
+
+  const auto nargs = static_cast<int>(args.size());
+  if (!detail::check_stack(co, nargs + 1))
+    throw std::bad_alloc{};
+
+  for (const auto i : cool::indices(args.size()))
+    args[i].push(sdata, co);
+
+  detail::enter(sdata, co);
+  const auto result = lua_resume(co, sdata.state, nargs);
+  const auto exceeded = sdata.budget.exceeded;
+  detail::leave(sdata, co);
+
+  if (result != LUA_OK && result != LUA_YIELD) {
+    if (detail::is_memory_error(sdata, result, lua_tostring(co, -1))) {
+      lua_pop(co, 1);
+      throw std::bad_alloc{};
+    }
+
+    std::string error = lua_tostring(co, -1);
+    lua_pop(co, 1);
+    if (exceeded)
+      throw budget_exceeded{std::move(error)};
+    throw std::runtime_error{std::move(error)};
+  }
+
+  const auto n = lua_gettop(co);
+  COOL_DEFER(lua_pop(co, n));
+
+  args.resize(n);
+  for (const auto i : cool::closed_indices(1, n))
+    args[i - 1] = value::at(sdata, co, i);
+
+  return args;
+}
+
+auto thread::get_status() const -> status { return status_of(get()); }
+
+// as coroutine.status.
+auto thread::status_of(lua_State* co) -> status
+{
+  switch (lua_status(co)) {
+  case LUA_YIELD:
+    return status::suspended;
+  case LUA_OK: {
+    lua_Debug ar;
+    if (lua_getstack(co, 0, &ar) > 0)
+      return status::running;
+    return lua_gettop(co) == 0 ? status::dead : status::suspended;
+  }
+  default:
+    return status::dead;
+  }
+}
+
+auto thread::push(state_data& sdata) const -> int
+{
+  const auto state = sdata.state;
+  return push(sdata, state);
+}
+
+auto thread::push(state_data& sdata, lua_State* state) const -> int
+{
+  assert(&sdata == ref_.state());
+
+  if (!detail::check_stack(state, 1))
+    throw std::bad_alloc{};
+
+  ref_.push(sdata, state);
+  return LUA_TTHREAD;
+}
+
+auto thread::operator==(const thread& other) const -> bool { return get() == other.get(); }
+auto thread::operator!=(const thread& other) const -> bool { return !(*this == other); }
+
+} // namespace lua
@@ -1,4 +1,7 @@
 #include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
 
 #include <luapp/tuple.hpp>
 #include <luapp/value.hpp>
@@ -6,11 +9,49 @@
 namespace lua
 {
 
-tuple::tuple() { values_.emplace_back(); }
+namespace
+{
+const value nil_value{}; // the virtual end of every tuple
+} // namespace
+
+tuple::tuple(std::vector<value> values) noexcept : size_(values.size())
+{
+  if (size_ > inline_capacity) {
+    heap_ = std::move(values);
+    return;
+  }
+
+  for (std::size_t i = 0; i < size_; ++i)
+    inline_[i] = std::move(values[i]);
+}
+
+tuple::tuple(tuple&& other) noexcept
+  : size_(other.size_), inline_(std::move(other.inline_)), heap_(std::move(other.heap_))
+{
+  other.clear();
+}
 
-tuple::tuple(std::vector<value> values) noexcept : values_(std::move(values))
+auto tuple::operator=(tuple&& other) noexcept -> tuple&
 {
-  values_.emplace_back();
+  if (this != &other) {
+    size_ = other.size_;
+    inline_ = std::move(other.inline_);
+    heap_ = std::move(other.heap_);
+    other.clear();
+  }
+  return *this;
+}
+
+auto tuple::clear() noexcept -> void
+{
+  inline_.fill(nil{});
+  heap_.clear();
+  size_ = 0;
+}
+
+auto tuple::data() const noexcept -> const value*
+{
+  return size_ > inline_capacity ? heap_.data() : inline_.data();
 }
 
 auto tuple::operator[](std::size_t i) const noexcept -> const value& { return at(i); }
@@ -18,22 +59,37 @@ auto tuple::operator[](std::size_t i) const noexcept -> const value& { return at
 auto tuple::operator[](std::size_t i) -> value&
 {
   assert(i < size());
-  return values_[i];
+  return const_cast<value&>(data()[i]);
 }
 
 auto tuple::at(std::size_t i) const noexcept -> const value&
 {
-  return i < values_.size() ? values_[i] : values_.back();
+  return i < size_ ? data()[i] : nil_value;
 }
 
-auto tuple::size() const noexcept -> std::size_t { return values_.size() - 1; }
+auto tuple::size() const noexcept -> std::size_t { return size_; }
 
 auto tuple::resize(std::size_t s) -> void
 {
-  values_.resize(s + 1);
-  values_.back() = nil{};
+  if (s > inline_capacity) {
+    if (size_ <= inline_capacity) {
+      heap_.reserve(s);
+      for (std::size_t i = 0; i < size_; ++i)
+        heap_.push_back(std::exchange(inline_[i], nil{}));
+    }
+    heap_.resize(s);
+  } else if (size_ > inline_capacity) {
+    for (std::size_t i = 0; i < s; ++i)
+      inline_[i] = std::move(heap_[i]);
+    heap_.clear();
+  } else {
+    for (std::size_t i = s; i < size_; ++i)
+      inline_[i] = nil{};
+  }
+
+  size_ = s;
 }
 
-tuple::operator const value&() const noexcept { return values_.front(); }
+tuple::operator const value&() const noexcept { return at(0); }
 
 } // namespace lua
@@ -1,4 +1,6 @@
 #include <cassert>
+#include <memory>
+#include <new>
 #include <typeindex>
 
 extern "C" {
@@ -12,45 +14,104 @@ extern "C" {
 namespace lua
 {
 
-auto userdata::create_reference(const state& s, std::type_index tidx, std::any data) -> reference
+namespace
 {
-  const auto sdata = s.data_;
-  const auto& metatable = s.get_metatable(tidx);
-  const auto state = sdata->state;
+// the user value of every userdata created by the library, which scripts cannot produce.
+char marker;
+} // namespace
 
-  auto p = lua_newuserdata(state, sizeof(std::any));
-  new (p) std::any(std::move(data));
+auto userdata::allocate(lua_State* state, std::size_t size) -> void*
+{
+  if (!detail::check_stack(state, 2))
+    throw std::bad_alloc{};
+
+  return lua_newuserdata(state, size);
+}
 
-  metatable.push(sdata, state);
+auto userdata::publish(state_data& sdata, lua_State* state, std::type_index tidx) -> void
+{
+  auto* h = static_cast<header*>(lua_touserdata(state, -1));
+  auto* shared = h->destroy ? nullptr : static_cast<shared_header*>(h);
+
+  if (shared && !sdata.memory.track_cpp)
+    shared->footprint = 0;
+
+  try {
+    detail::metatable_of(sdata, tidx).push(sdata, state);
+  } catch (...) {
+    if (shared)
+      shared->footprint = 0;
+    finalize(sdata, *h);
+    discard(state);
+    throw;
+  }
   lua_setmetatable(state, -2);
 
-  return reference(sdata, luaL_ref(state, LUA_REGISTRYINDEX));
+  lua_pushlightuserdata(state, &marker);
+  lua_setuservalue(state, -2);
+
+  if (shared)
+    sdata.memory.charge(shared->footprint);
+  LUAPP_STAT(++sdata.stats.userdata_created);
 }
 
-userdata::userdata(reference ref) noexcept : ref_(std::move(ref)) {}
+auto userdata::pop(state_data& sdata) -> userdata
+{
+  return userdata(reference(sdata, luaL_ref(sdata.state, LUA_REGISTRYINDEX)));
+}
 
-userdata::userdata(const state& state, std::type_index tidx, std::any data)
-  : ref_(create_reference(state, tidx, std::move(data)))
-{}
+auto userdata::header_at(lua_State* state, int index) noexcept -> header*
+{
+  if (lua_type(state, index) != LUA_TUSERDATA)
+    return nullptr;
 
-auto userdata::push(std::shared_ptr<state_data> state_data) const -> int
+  const auto ours =
+    lua_getuservalue(state, index) == LUA_TLIGHTUSERDATA && lua_touserdata(state, -1) == &marker;
+  lua_pop(state, 1);
+
+  return ours ? static_cast<header*>(lua_touserdata(state, index)) : nullptr;
+}
+
+auto userdata::discard(lua_State* state) noexcept -> void { lua_pop(state, 1); }
+
+auto userdata::finalize(state_data& sdata, header& h) noexcept -> void
+{
+  if (!h.tag)
+    return;
+
+  if (h.destroy) {
+    h.destroy(h);
+  } else {
+    auto& shared = static_cast<shared_header&>(h);
+    if (shared.footprint != 0)
+      sdata.memory.credit(shared.footprint);
+    shared.~shared_header();
+  }
+
+  // a finalizer may have stored the userdata somewhere: it no longer holds an object.
+  new (&h) header{};
+}
+
+userdata::userdata(reference ref) noexcept : ref_(std::move(ref)) {}
+
+auto userdata::push(state_data& state_data) const -> int
 {
-  const auto state = state_data->state;
-  return push(std::move(state_data), state);
+  const auto state = state_data.state;
+  return push(state_data, state);
 }
 
-auto userdata::push(std::shared_ptr<state_data> state_data, lua_State* state) const -> int
+auto userdata::push(state_data& state_data, lua_State* state) const -> int
 {
-  assert(state_data->state == state);
-  return ref_.push(std::move(state_data), state);
+  assert(&state_data == ref_.state());
+  return ref_.push(state_data, state);
 }
 
 auto userdata::operator==(const userdata& other) const -> bool
 {
-  const auto sdata = ref_.state();
-  assert(sdata == other.ref_.state());
+  auto& sdata = *ref_.state();
+  assert(&sdata == other.ref_.state());
 
-  const auto state = sdata->state;
+  const auto state = sdata.state;
 
   push(sdata);
   COOL_DEFER(lua_pop(state, 1));
@@ -58,17 +119,24 @@ auto userdata::operator==(const userdata& other) const -> bool
   other.push(sdata);
   COOL_DEFER(lua_pop(state, 1));
 
-  return lua_compare(sdata->state, -1, -2, LUA_OPEQ);
+  return lua_compare(sdata.state, -1, -2, LUA_OPEQ);
 }
 
 auto userdata::operator!=(const userdata& other) const -> bool { return !(*this == other); }
 
-auto userdata::data() const -> std::any*
+auto userdata::type() const -> std::type_index
+{
+  const auto* tag = data()->tag;
+  return tag ? tag->info : typeid(void);
+}
+
+auto userdata::data() const -> const header*
 {
-  const auto state = ref_.state()->state;
-  ref_.push(ref_.state(), state);
+  auto& sdata = *ref_.state();
+  const auto state = sdata.state;
+  ref_.push(sdata, state);
   COOL_DEFER(lua_pop(state, 1));
-  return reinterpret_cast<std::any*>(lua_touserdata(state, -1));
+  return static_cast<const header*>(lua_touserdata(state, -1));
 }
 
 } // namespace lua
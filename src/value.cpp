@@ -1,5 +1,6 @@
 #include <cassert>
 #include <stdexcept>
+#include <string_view>
 #include <type_traits>
 
 extern "C" {
@@ -16,34 +17,32 @@ namespace lua
 {
 
 // XXX: must deal with lua::function as well.
-auto value::checkudata(std::shared_ptr<state_data> state_data, reference ref) -> value
+auto value::checkudata(lua_State* state, int index, reference ref) -> value
 {
-  const auto state = state_data->state;
-
-  ref.push(state_data);
-  COOL_DEFER(lua_pop(state, 1));
-
-  if (!lua_getmetatable(state, -1))
+  if (!userdata::header_at(state, index))
     return nil{};
-
-  reference metaref(state_data, luaL_ref(state, LUA_REGISTRYINDEX));
-  table metatable(metaref);
-
-  if (!get(metatable, "__luapp_userdata").get_boolean_or(false))
-    return nil{};
-
   return userdata(std::move(ref));
 }
 
-auto value::at(std::shared_ptr<state_data> state_data, int index) -> value
+auto value::string_at([[maybe_unused]] state_data& state_data, lua_State* state, int index)
+  -> string
+{
+  std::size_t size;
+  const auto* data = lua_tolstring(state, index, &size);
+  LUAPP_STAT(detail::count_string(state_data, size));
+  return string(data, size);
+}
+
+auto value::at(state_data& state_data, int index) -> value
 {
-  const auto state = state_data->state;
-  return at(std::move(state_data), state, index);
+  const auto state = state_data.state;
+  return at(state_data, state, index);
 }
 
-auto value::at(std::shared_ptr<state_data> state_data, lua_State* state, int index) -> value
+auto value::at(state_data& state_data, lua_State* state, int index) -> value
 {
   const auto type = lua_type(state, index);
+  LUAPP_STAT(++state_data.stats.conversions[type == LUA_TNONE ? LUA_TNIL : type]);
 
   switch (type) {
   case LUA_TNUMBER:
@@ -54,7 +53,7 @@ auto value::at(std::shared_ptr<state_data> state_data, lua_State* state, int ind
   case LUA_TBOOLEAN:
     return boolean{static_cast<bool>(lua_toboolean(state, index))};
   case LUA_TSTRING:
-    return string{lua_tostring(state, index)};
+    return string_at(state_data, state, index);
   }
 
   // XXX: assumes LUA_REGISTRYINDEX is shared
@@ -65,11 +64,12 @@ auto value::at(std::shared_ptr<state_data> state_data, lua_State* state, int ind
   case LUA_TTABLE:
     return table(std::move(ref));
   case LUA_TUSERDATA:
-    return checkudata(std::move(state_data), std::move(ref));
+    return checkudata(state, index, std::move(ref));
   case LUA_TFUNCTION:
     return function(std::move(ref));
-  case LUA_TLIGHTUSERDATA:
   case LUA_TTHREAD:
+    return thread(std::move(ref));
+  case LUA_TLIGHTUSERDATA:
     throw std::runtime_error{"invalid type"};
   case LUA_TNIL:
   default:
@@ -77,15 +77,17 @@ auto value::at(std::shared_ptr<state_data> state_data, lua_State* state, int ind
   }
 }
 
-auto value::from_ref(std::shared_ptr<state_data> state_data, const reference& ref) -> variant
+auto value::from_ref(const reference& ref) -> variant
 {
   if (!ref.valid())
     return nil{};
 
-  const auto state = state_data->state;
+  auto& state_data = *ref.state();
+  const auto state = state_data.state;
 
   const auto type = ref.push(state_data);
   COOL_DEFER(lua_pop(state, 1));
+  LUAPP_STAT(++state_data.stats.conversions[type]);
 
   switch (type) {
   case LUA_TNUMBER:
@@ -96,15 +98,16 @@ auto value::from_ref(std::shared_ptr<state_data> state_data, const reference& re
   case LUA_TBOOLEAN:
     return boolean{static_cast<bool>(lua_toboolean(state, -1))};
   case LUA_TSTRING:
-    return string{lua_tostring(state, -1)};
+    return string_at(state_data, state, -1);
   case LUA_TTABLE:
     return table(ref);
   case LUA_TUSERDATA:
-    return checkudata(std::move(state_data), ref);
+    return checkudata(state, -1, ref);
   case LUA_TFUNCTION:
     return function(ref);
-  case LUA_TLIGHTUSERDATA:
   case LUA_TTHREAD:
+    return thread(ref);
+  case LUA_TLIGHTUSERDATA:
     throw std::runtime_error{"invalid type"};
   case LUA_TNIL:
   default:
@@ -112,11 +115,11 @@ auto value::from_ref(std::shared_ptr<state_data> state_data, const reference& re
   }
 }
 
-value::value(const reference& ref) : variant{from_ref(ref.state(), ref)} {}
+value::value(const reference& ref) : variant{from_ref(ref)} {}
 
 template <typename T>
 auto from_optional(std::optional<T> v)
-  -> std::variant<nil, floating, integer, boolean, string, function, userdata, table>
+  -> std::variant<nil, floating, integer, boolean, string, function, userdata, table, thread>
 {
   if (v.has_value())
     return *v;
@@ -130,9 +133,17 @@ value::value(std::optional<string> v) noexcept : variant(from_optional(v)) {}
 value::value(std::optional<function> v) noexcept : variant(from_optional(v)) {}
 value::value(std::optional<userdata> v) noexcept : variant(from_optional(v)) {}
 value::value(std::optional<table> v) noexcept : variant(from_optional(v)) {}
+value::value(std::optional<thread> v) noexcept : variant(from_optional(v)) {}
 
 auto value::get_string_or(string value) const -> string { return get_or<string>(std::move(value)); }
 
+auto value::get_string_view_or(std::string_view value) const& noexcept -> std::string_view
+{
+  if (is<string>())
+    return std::get<string>(as_variant());
+  return value;
+}
+
 auto value::get_function_or(function value) const noexcept -> function
 {
   return get_or<function>(std::move(value));
@@ -148,6 +159,11 @@ auto value::get_table_or(table value) const noexcept -> table
   return get_or<table>(std::move(value));
 }
 
+auto value::get_thread_or(thread value) const noexcept -> thread
+{
+  return get_or<thread>(std::move(value));
+}
+
 value::operator std::optional<string>() const
 {
   if (is<string>())
@@ -155,6 +171,13 @@ value::operator std::optional<string>() const
   return std::nullopt;
 }
 
+value::operator std::optional<std::string_view>() const& noexcept
+{
+  if (is_string())
+    return get_string_view_or({});
+  return std::nullopt;
+}
+
 value::operator std::optional<function>() const noexcept
 {
   if (is<function>())
@@ -176,15 +199,22 @@ value::operator std::optional<table>() const noexcept
   return std::nullopt;
 }
 
-auto value::push(std::shared_ptr<state_data> state_data) const -> int
+value::operator std::optional<thread>() const noexcept
+{
+  if (is<thread>())
+    return std::get<thread>(as_variant());
+  return std::nullopt;
+}
+
+auto value::push(state_data& state_data) const -> int
 {
-  const auto state = state_data->state;
-  return push(std::move(state_data), state);
+  const auto state = state_data.state;
+  return push(state_data, state);
 }
 
-auto value::push(std::shared_ptr<state_data> state_data, lua_State* state) const -> int
+auto value::push(state_data& state_data, lua_State* state) const -> int
 {
-  if (!lua_checkstack(state, 1))
+  if (!detail::check_stack(state, 1))
     throw std::bad_alloc{};
 
   return std::visit(cool::compose{
@@ -223,10 +253,21 @@ auto detail::setter::operator()(const table& t, const value& key, const value& v
   t.set(key, v);
 }
 
+auto detail::getter::operator()(const table& t, const key& k) const -> value { return t.get(k); }
+
+auto detail::setter::operator()(const table& t, const key& k, const value& v) const -> void
+{
+  t.set(k, v);
+}
+
 auto get(const table& t, const value& key) -> value { return detail::getter{}(t, key); }
 
 auto set(const table& t, const value& key, const value& v) -> void { detail::setter{}(t, key, v); }
 
+auto get(const table& t, const key& k) -> value { return detail::getter{}(t, k); }
+
+auto set(const table& t, const key& k, const value& v) -> void { detail::setter{}(t, k, v); }
+
 auto value::operator==(const value& other) const -> bool
 {
   return std::visit(
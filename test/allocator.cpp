@@ -0,0 +1,120 @@
+#include <catch.hpp>
+
+#include <algorithm>
+#include <luapp/allocator.hpp>
+#include <luapp/state.hpp>
+#include <luapp/value.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// sum of the number of digits of 1, ..., 10000.
+constexpr auto script = R"lua(
+  local t = {}
+  for i = 1, 10000 do t[i] = { tostring(i) } end
+
+  local n = 0
+  for _, v in ipairs(t) do n = n + #v[1] end
+  return n
+)lua";
+
+constexpr lua::integer expected = 9 * 1 + 90 * 2 + 900 * 3 + 9000 * 4 + 5;
+} // namespace
+
+TEST_CASE("Custom allocators", "[allocator]")
+{
+  using namespace lua;
+
+  struct counting_allocator final : allocator
+  {
+    std::size_t calls = 0;
+    std::size_t live = 0;
+
+    auto reallocate(void* ptr, std::size_t osize, std::size_t nsize) noexcept -> void* override
+    {
+      ++calls;
+      live = live + nsize - osize;
+      return base.reallocate(ptr, osize, nsize);
+    }
+
+    default_allocator base;
+  };
+
+  const auto alloc = std::make_shared<counting_allocator>();
+  {
+    const state s(alloc);
+    const value n = s.do_string(script);
+    CHECK(n == expected);
+    CHECK(alloc->calls > 0);
+    CHECK(alloc->live > 0);
+  }
+
+  // everything is given back when the state is closed.
+  CHECK(alloc->live == 0);
+}
+
+TEST_CASE("Pool allocator", "[allocator]")
+{
+  using namespace lua;
+
+  const auto pool = std::make_shared<pool_allocator>();
+
+  {
+    const state s(pool);
+    const value n = s.do_string(script);
+    CHECK(n == expected);
+  }
+
+  // the same pool serves states running on several threads.
+  std::vector<integer> results(4);
+  {
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < results.size(); ++i)
+      threads.emplace_back([&, i] {
+        const state s(pool);
+        for (int j = 0; j < 3; ++j)
+          results[i] = static_cast<value>(s.do_string(script)).get_integer_or(0);
+      });
+
+    for (auto& t : threads)
+      t.join();
+  }
+
+  for (const auto n : results)
+    CHECK(n == expected);
+
+  // blocks of finished threads are reused.
+  const state s(pool);
+  const value n = s.do_string(script);
+  CHECK(n == expected);
+
+  // so are those of threads that only free, more than a slab's worth of them.
+  std::vector<void*> blocks(10000);
+  for (auto& b : blocks)
+    b = pool->reallocate(nullptr, 0, 32);
+  std::thread([&] {
+    for (auto* b : blocks)
+      pool->reallocate(b, 32, 0);
+  }).join();
+  for (auto& b : blocks)
+    b = pool->reallocate(nullptr, 0, 32);
+  CHECK(std::find(blocks.begin(), blocks.end(), nullptr) == blocks.end());
+  for (auto* b : blocks)
+    pool->reallocate(b, 32, 0);
+}
+
+TEST_CASE("Arena allocator", "[allocator]")
+{
+  using namespace lua;
+
+  const auto arena = std::make_shared<arena_allocator>(4096);
+  {
+    const state s(arena);
+    const value n = s.do_string(script);
+    CHECK(n == expected);
+  }
+
+  CHECK(arena->reserved() > 4096);
+}
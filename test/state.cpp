@@ -1,8 +1,26 @@
 #include <catch.hpp>
 
+#include <array>
+#include <cstddef>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <luapp/state.hpp>
 #include <luapp/value.hpp>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 TEST_CASE("Basic state manipulation", "[state]")
 {
@@ -181,6 +199,121 @@ TEST_CASE("Functions called from lua", "[state]")
   }
 }
 
+TEST_CASE("Typed functions", "[state]")
+{
+  using namespace lua;
+  state s;
+  table g = s.global_table();
+
+  {
+    function f = +[](integer a, double b, bool c, std::string_view d) {
+      return std::tuple{a * 2, b / 2, !c, std::string(d) + "!"};
+    };
+    set(g, "f", f);
+
+    const auto [a, b, c, d] = s.do_string(returns<4>, R"( return f(21, 3, nil, "hi") )");
+    CHECK(a.is_integer());
+    CHECK(a == integer{42});
+    CHECK(b == floating{1.5});
+    CHECK(c == true);
+    CHECK(d == "hi!");
+
+    // Lua conversions apply to the arguments.
+    CHECK(s.do_string(R"( return f("2", 1.0, true, 10) )")[0] == integer{4});
+
+    // and the same function is callable from C++.
+    const auto [x, y, z] = f(returns<3>, integer{1}, floating{2}, false, "");
+    CHECK(x == integer{2});
+    CHECK(y == floating{1});
+    CHECK(z == true);
+  }
+
+  {
+    int calls = 0;
+    function f = [&calls](int n) -> void { calls += n; };
+    set(g, "f", f);
+
+    CHECK(s.do_string("f(1) f(2) return f(3)").size() == 0);
+    CHECK(calls == 6);
+  }
+
+  {
+    struct counter
+    {
+      int n = 0;
+    };
+
+    function f = [](counter* c) -> bool {
+      if (!c)
+        return false;
+      ++c->n;
+      return true;
+    };
+    set(g, "f", f);
+
+    const auto udata = s.create_userdata(std::in_place_type<counter>);
+    set(g, "udata", udata);
+
+    const auto [a, b] = s.do_string(returns<2>, "return f(udata), f({})");
+    CHECK(a == true);
+    CHECK(b == false);
+    CHECK(static_cast<std::shared_ptr<counter>>(value(udata))->n == 1);
+  }
+
+  // bad arguments and exceptions become Lua errors.
+  {
+    set(g, "f", function([](integer) -> integer { throw std::runtime_error{"from C++"}; }));
+
+    {
+      const auto [ok, msg] = s.do_string(returns<2>, "return pcall(f, 'x')");
+      CHECK(ok == false);
+      CHECK(msg.get_string_or("").find("bad argument #1 (integer expected, got string)") !=
+            std::string::npos);
+    }
+
+    {
+      const auto [ok, msg] = s.do_string(returns<2>, "return pcall(f, 1)");
+      CHECK(ok == false);
+      CHECK(msg.get_string_or("").find("from C++") != std::string::npos);
+    }
+
+    CHECK_THROWS_AS(s.do_string("f(1.5)"), std::runtime_error);
+  }
+}
+
+TEST_CASE("Pushing C++ functions", "[state]")
+{
+  using namespace lua;
+  state s(state::std_libs);
+  table g = s.global_table();
+
+  {
+    function f = [](integer a) { return a + 1; };
+    set(g, "f", f);
+    set(g, "g", f);
+    CHECK(s.do_string("return rawequal(f, g)")[0] == true);
+
+    // the closure is created once, so pushing it again makes no garbage.
+    const auto t = s.create_table();
+    s.do_string("collectgarbage() collectgarbage('stop')");
+    const auto before = s.memory_usage();
+    for (integer i = 1; i <= 100; ++i)
+      set(t, i, f);
+    CHECK(s.memory_usage() - before < 100 * 64);
+    s.do_string("collectgarbage('restart')");
+  }
+
+  // once Lua drops it, the closure is collected and the callable released.
+  {
+    auto alive = std::make_shared<int>();
+    std::weak_ptr<int> weak = alive;
+
+    set(g, "f", function([alive = std::move(alive)] { return *alive; }));
+    s.do_string("f = nil g = nil collectgarbage() collectgarbage()");
+    CHECK(weak.expired());
+  }
+}
+
 TEST_CASE("Calling Lua functions", "[state]")
 {
   using namespace lua;
@@ -263,3 +396,703 @@ TEST_CASE("Registering metatables", "[state]")
     CHECK_THROWS(s.register_metatable(typeid(foo), {}));
   }
 }
+
+TEST_CASE("Inline userdata", "[state]")
+{
+  using namespace lua;
+  struct vec
+  {
+    double x, y;
+    int* live;
+
+    vec(double x, double y, int* live) : x(x), y(y), live(live) { ++*live; }
+    vec(const vec& other) : x(other.x), y(other.y), live(other.live) { ++*live; }
+    ~vec() { --*live; }
+  };
+
+  struct alignas(32) wide
+  {
+    double v[4];
+  };
+
+  int live = 0;
+  {
+    const state s(state::std_libs);
+    const table g = s.global_table();
+
+    table index = s.create_table();
+    set(index, "scale", function([](vec& v, double k) {
+          v.x *= k;
+          v.y *= k;
+        }));
+    set(index, "sum", function([](const vec& v) { return v.x + v.y; }));
+    set(index, "ptr", function([](const vec* v) { return v != nullptr; }));
+    s.register_metatable(typeid(vec), {{"__index", index}});
+
+    const auto u = s.emplace_userdata<vec>(1.0, 2.0, &live);
+    CHECK(live == 1);
+    set(g, "v", u);
+
+    CHECK(s.do_string("v:scale(2) return v:sum()")[0] == 6.0);
+    REQUIRE(u.get<vec>());
+    CHECK(u.get<vec>()->x == 2.0);
+    CHECK(u.get<wide>() == nullptr);
+    CHECK(live == 1); // borrowed, never copied
+
+    CHECK(s.do_string("return v:ptr()")[0] == true);
+    CHECK(s.do_string("return getmetatable(v).__index.ptr(42)")[0] == false);
+    CHECK_THROWS_WITH(s.do_string("getmetatable(v).__index.sum({})"),
+                      Catch::Contains("matching userdata"));
+
+    // shared objects are borrowed in the same way.
+    set(g, "w", s.create_userdata(std::in_place_type<vec>, 1.0, 1.0, &live));
+    CHECK(s.do_string("w:scale(3) return w:sum()")[0] == 6.0);
+
+    // inline objects are not shared; the handle keeps them alive.
+    CHECK(u.cast<vec>() == nullptr);
+    CHECK(static_cast<std::shared_ptr<vec>>(value(u)) == nullptr);
+    s.do_string("v = nil w = nil collectgarbage()");
+    CHECK(live == 1);
+    CHECK(u.get<vec>()->y == 4.0);
+
+    const auto a = s.emplace_userdata<wide>();
+    CHECK(reinterpret_cast<std::uintptr_t>(a.get<wide>()) % alignof(wide) == 0);
+
+    struct failing
+    {
+      failing() { throw std::runtime_error{"no"}; }
+    };
+    CHECK_THROWS_WITH(s.emplace_userdata<failing>(), "no");
+
+    // a finalizer may resurrect a userdata whose object is destroyed in the same cycle.
+    set(g, "r", s.emplace_userdata<vec>(1.0, 1.0, &live));
+    s.do_string(R"lua(
+      setmetatable({r}, {__gc = function(t) kept = t[1] end})
+      r = nil
+      collectgarbage()
+    )lua");
+    CHECK(live == 1);
+    const auto kept = get(g, "kept").get_userdata_or(u);
+    CHECK(kept != u);
+    CHECK(kept.get<vec>() == nullptr);
+    CHECK(kept.type() == typeid(void));
+    CHECK_THROWS_WITH(s.do_string("kept:sum()"), Catch::Contains("matching userdata"));
+  }
+  // destroyed with the state at the latest.
+  CHECK(live == 0);
+}
+
+TEST_CASE("Recognizing userdata", "[state]")
+{
+  using namespace lua;
+  struct a
+  {
+    int x = 1;
+  };
+  struct b
+  {
+    int y = 2;
+  };
+
+  const state s(state::std_libs);
+  const table g = s.global_table();
+  set(g, "a", s.emplace_userdata<a>());
+  set(g, "b", s.create_userdata(b{}));
+  set(g, "get_a", function([](const a* p) { return p ? p->x : 0; }));
+
+  const auto before = s.stats();
+  const value va = get(g, "a");
+  const value vb = get(g, "b");
+  const auto after = s.stats();
+
+  REQUIRE(va.is<userdata>());
+  REQUIRE(vb.is<userdata>());
+  CHECK(std::get<userdata>(va.as_variant()).type() == typeid(a));
+  CHECK(std::get<userdata>(vb.as_variant()).type() == typeid(b));
+#ifdef LUAPP_STATS
+  // only the handles themselves: the metatables are never looked at.
+  CHECK(after.refs_created == before.refs_created + 2);
+#else
+  CHECK(after.refs_created == before.refs_created);
+#endif
+
+  CHECK(s.do_string("return get_a(a)")[0] == integer{1});
+  CHECK(s.do_string("return get_a(b)")[0] == integer{0});
+  // userdata created elsewhere are not the library's.
+  CHECK(s.do_string("return get_a(io.stdout)")[0] == integer{0});
+  CHECK(s.do_string("return io.stdout")[0].is<nil>());
+}
+
+namespace
+{
+struct vector2
+{
+  double x, y;
+
+  auto norm() const -> double { return std::sqrt(x * x + y * y); }
+  auto scale(double k) -> void { x *= k, y *= k; }
+  auto dot(const vector2& other) const -> double { return x * other.x + y * other.y; }
+  auto size() const -> std::size_t { return 2; }
+  auto operator()(int i) const -> double { return i == 1 ? x : y; }
+  auto translate(double dx, double dy) -> vector2&
+  {
+    x += dx, y += dy;
+    return *this;
+  }
+
+  friend auto operator+(const vector2& a, const vector2& b) -> vector2
+  {
+    return {a.x + b.x, a.y + b.y};
+  }
+  friend auto operator-(const vector2& a) -> vector2 { return {-a.x, -a.y}; }
+  friend auto operator==(const vector2&, const vector2&) -> bool = default;
+  friend auto operator<(const vector2& a, const vector2& b) -> bool { return a.norm() < b.norm(); }
+  friend auto operator<<(std::ostream& out, const vector2& v) -> std::ostream&
+  {
+    return out << "(" << v.x << ", " << v.y << ")";
+  }
+};
+
+auto origin() -> vector2 { return {0, 0}; }
+} // namespace
+
+TEST_CASE("Binding classes", "[state]")
+{
+  using namespace lua;
+  const state s(state::std_libs);
+
+  const table vector = s.register_class<vector2>()
+                         .constructor<double, double>()
+                         .method<&vector2::norm>("norm")
+                         .method<&vector2::scale>("scale")
+                         .method<&vector2::dot>("dot")
+                         .method<&vector2::translate>("translate")
+                         .method<&origin>("origin")
+                         .methods();
+  set(s.global_table(), "vector", vector);
+
+  CHECK(s.do_string("return vector.new(3, 4):norm()")[0] == 5.0);
+  CHECK(s.do_string("local v = vector.new(3, 4) v:scale(2) return v:norm()")[0] == 10.0);
+  CHECK(s.do_string("return vector.new(1, 2):dot(vector.new(3, 4))")[0] == 11.0);
+
+  // methods returning `*this` chain on the same object.
+  const auto [same, norm] = s.do_string(R"lua(
+    local v = vector.new(0, 0)
+    local w = v:translate(1, 0):translate(1, 0):translate(1, 4)
+    return rawequal(v, w), v:norm()
+  )lua").expand(returns<2>);
+  CHECK(same == true);
+  CHECK(norm == 5.0);
+
+  // operators.
+  CHECK(s.do_string("return (vector.new(1, 2) + vector.new(2, 2)):norm()")[0] == 5.0);
+  CHECK(s.do_string("return (-vector.new(3, 4)):dot(vector.origin())")[0] == 0.0);
+  CHECK(s.do_string("return vector.new(1, 2) == vector.new(1, 2)")[0] == true);
+  CHECK(s.do_string("return vector.new(1, 2) ~= vector.new(2, 1)")[0] == true);
+  CHECK(s.do_string("return vector.new(1, 2) == io.stdout")[0] == false);
+  CHECK(s.do_string("return vector.new(1, 1) < vector.new(2, 2)")[0] == true);
+  CHECK(s.do_string("return #vector.new(1, 1)")[0] == integer{2});
+  CHECK(s.do_string("return vector.new(5, 6)(2)")[0] == 6.0);
+  CHECK(s.do_string("return tostring(vector.new(1, 2))")[0] == "(1, 2)");
+
+  // objects made in Lua are seen from C++, and the other way around.
+  const value v = s.do_string("return vector.new(1, 2)")[0];
+  REQUIRE(std::get<userdata>(v.as_variant()).get<vector2>());
+  CHECK(std::get<userdata>(v.as_variant()).get<vector2>()->y == 2.0);
+  set(s.global_table(), "w", s.emplace_userdata<vector2>(6.0, 8.0));
+  CHECK(s.do_string("return w:norm()")[0] == 10.0);
+
+  CHECK_THROWS_WITH(s.do_string("return vector.new(1, 2).norm({})"),
+                    Catch::Contains("bad argument #1"));
+  CHECK_THROWS_WITH(s.do_string("return vector.new(1, 2):dot(3)"),
+                    Catch::Contains("bad argument #2"));
+  CHECK_THROWS(s.register_class<vector2>());
+}
+
+TEST_CASE("Compiled chunks", "[state]")
+{
+  using namespace lua;
+  const state s;
+  const table g = s.global_table();
+
+  {
+    chunk c = s.load("n = (n or 0) + 1 return n", "counter");
+    CHECK(c.name() == "counter");
+    CHECK(get(g, "n").is_nil());
+
+    const value a = c();
+    const value b = c();
+    CHECK(a == integer{1});
+    CHECK(b == integer{2});
+
+    chunk bad = s.load("error('boom')", "bad");
+    CHECK_THROWS_WITH(bad(), Catch::Contains("bad") && Catch::Contains("boom"));
+
+    CHECK_THROWS(s.load("return +"));
+
+    // unnamed chunks are named after the start of their source.
+    CHECK(s.load("return 1").name() == R"([string "return 1"])");
+    CHECK(s.load("local a = 1\nreturn a").name() == R"([string "local a = 1..."])");
+
+    const auto code = "error('long') -- " + std::string(100, 'x');
+    chunk long_chunk = s.load(code.c_str());
+    CHECK(long_chunk.name() == R"([string "error('long') -- )" + std::string(28, 'x') + R"(..."])");
+    CHECK_THROWS_WITH(long_chunk(), Catch::StartsWith(long_chunk.name() + ":1: long"));
+  }
+
+  {
+    s.set_chunk_cache(2);
+
+    for (int i = 0; i < 3; ++i)
+      s.do_string("x = (x or 0) + 1");
+    s.do_string("return 2");
+    s.do_string("return 3");
+
+    // cached chunks still run against the current globals.
+    CHECK(get(g, "x") == integer{3});
+
+    const auto stats = s.chunk_cache_stats();
+    CHECK(stats.hits == 2);
+    CHECK(stats.misses == 3);
+    CHECK(stats.size == 2);
+    CHECK(stats.capacity == 2);
+
+    CHECK_THROWS(s.do_string("error('cached')"));
+    CHECK_THROWS(s.do_string("error('cached')"));
+    CHECK(s.chunk_cache_stats().hits == 3);
+
+    // the same source under another name is compiled again, so that errors name it.
+    CHECK_THROWS_WITH(s.do_string("error('named')", "=first"), Catch::Contains("first:1:"));
+    CHECK_THROWS_WITH(s.do_string("error('named')", "=second"), Catch::Contains("second:1:"));
+    CHECK_THROWS_WITH(s.do_string("error('named')", "=first"), Catch::Contains("first:1:"));
+    CHECK(s.chunk_cache_stats().hits == 4);
+
+    s.set_chunk_cache(0);
+    CHECK(s.chunk_cache_stats().size == 0);
+  }
+}
+
+TEST_CASE("Precompiled chunks", "[state]")
+{
+  using namespace lua;
+  const state s;
+
+  const auto c = s.load("local a, b = ... return a * b", "=mul");
+  const auto full = c.dump();
+  const auto stripped = c.dump(true);
+
+  CHECK(!full.empty());
+  CHECK(stripped.size() <= full.size());
+
+  {
+    const state other;
+    chunk a = other.load_binary(full);
+    chunk b = other.load_binary(stripped, "=stripped");
+
+    const value x = a(integer{6}, integer{7});
+    const value y = b(integer{6}, integer{7});
+    CHECK(x == integer{42});
+    CHECK(y == integer{42});
+    CHECK(b.name() == "=stripped");
+
+    // binary and text modes are never mixed up.
+    const std::string source = "return 1";
+    CHECK_THROWS(other.load_binary(std::as_bytes(std::span(source))));
+    CHECK_THROWS(other.load(reinterpret_cast<const char*>(full.data())));
+  }
+
+  {
+    const auto path = std::filesystem::temp_directory_path() / "luapp_precompiled_chunk.luac";
+    {
+      std::ofstream out(path, std::ios::binary);
+      out.write(reinterpret_cast<const char*>(full.data()), full.size());
+    }
+
+    chunk f = s.load_file(path.string().c_str());
+    const value x = f(integer{2}, integer{3});
+    CHECK(x == integer{6});
+
+    std::filesystem::remove(path);
+    CHECK_THROWS(s.load_file(path.string().c_str()));
+  }
+}
+
+TEST_CASE("Memory accounting", "[state]")
+{
+  using namespace lua;
+
+  SECTION("usage and peak")
+  {
+    const state s;
+    const auto initial = s.memory_usage();
+    CHECK(initial > 0);
+    CHECK(s.memory_peak() >= initial);
+    CHECK(s.memory_limit() == 0);
+
+    s.do_string("t = {} for i = 1, 100000 do t[i] = i end");
+    const auto filled = s.memory_usage();
+    CHECK(filled > initial + 100000 * sizeof(lua_Integer));
+
+    s.do_string("t = nil collectgarbage()");
+    CHECK(s.memory_usage() < filled);
+    CHECK(s.memory_peak() >= filled);
+
+    s.reset_memory_peak();
+    CHECK(s.memory_peak() == s.memory_usage());
+  }
+
+  SECTION("hard limit")
+  {
+    const state s;
+    s.set_memory_limit(s.memory_usage() + 1024 * 1024);
+
+    CHECK_THROWS_AS(s.do_string("t = {} for i = 1, 1000000 do t[i] = i end"), std::bad_alloc);
+    s.do_string("t = nil collectgarbage()");
+
+    const auto f = s.load("local t = {} for i = 1, ... do t[i] = i end return #t");
+    CHECK_THROWS_AS(f.call(tuple{1000000}), std::bad_alloc);
+
+    // the standard library reports buffer allocations as ordinary errors.
+    CHECK_THROWS_AS(s.do_string("return string.rep('x', 4 * 1024 * 1024)"), std::bad_alloc);
+    CHECK_THROWS_AS(s.do_string("local t = {} for i = 1, 1000 do t[i] = ('x'):rep(1000) end "
+                                "return table.concat(t)"),
+                    std::bad_alloc);
+    CHECK_THROWS_WITH(s.do_string("error('not enough memory, says the script')"),
+                      Catch::Contains("says the script"));
+
+    // the state remains usable, within the limit.
+    const value r = f.call(tuple{1024});
+    CHECK(r == integer{1024});
+
+    s.set_memory_limit(0);
+    s.do_string("return string.rep('x', 4 * 1024 * 1024)");
+  }
+
+  SECTION("library allocations")
+  {
+    const state s(state::std_libs | state::track_cpp_memory);
+
+    const auto before = s.memory_usage();
+    {
+      const auto u = s.create_userdata(std::array<char, 1 << 16>{});
+      CHECK(s.memory_usage() >= before + (1 << 16));
+    }
+    s.do_string("collectgarbage()");
+    CHECK(s.memory_usage() < before + (1 << 16));
+  }
+}
+
+TEST_CASE("Execution budgets", "[state]")
+{
+  using namespace lua;
+  const state s;
+  const auto spin = s.load("while true do end");
+
+  SECTION("instructions")
+  {
+    s.set_budget({.instructions = 100000});
+    CHECK(s.budget().instructions == 100000);
+
+    CHECK_THROWS_AS(s.do_string("while true do end"), budget_exceeded);
+    CHECK_THROWS_AS(spin.call(tuple{}), budget_exceeded);
+
+    // scripts cannot catch their way out.
+    CHECK_THROWS_AS(s.do_string("while true do pcall(function() while true do end end) end"),
+                    budget_exceeded);
+
+    // nor can C++ callbacks calling back into Lua.
+    set(s.global_table(), "nested", function([&] { spin.call(tuple{}); }));
+    CHECK_THROWS_AS(s.do_string("nested()"), budget_exceeded);
+
+    // each call starts with a fresh budget.
+    for (int i = 0; i < 10; ++i)
+      CHECK(s.do_string("local n = 0 for i = 1, 1000 do n = n + i end return n")[0] ==
+            integer{500500});
+
+    s.set_budget({});
+    s.do_string("for i = 1, 1000000 do end");
+  }
+
+  SECTION("time")
+  {
+    using namespace std::chrono_literals;
+    s.set_budget({.time = 10ms});
+
+    const auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS_AS(spin.call(tuple{}), budget_exceeded);
+    CHECK(std::chrono::steady_clock::now() - start >= 10ms);
+
+    CHECK(s.do_string("return 1")[0] == integer{1});
+  }
+
+  SECTION("coroutines yield")
+  {
+    s.set_budget({.instructions = 10000});
+
+    const auto co =
+      s.create_thread(s.load("local i = 0 while i < 100000 do i = i + 1 end return i"));
+    int slices = 0;
+    tuple t;
+    while (co.get_status() == thread::status::suspended) {
+      t = co.resume();
+      ++slices;
+    }
+    CHECK(slices > 10);
+    CHECK(t[0] == integer{100000});
+
+    // unless they cannot.
+    const auto stuck =
+      s.create_thread(s.load("table.sort({1, 2, 3}, function() while 1 do end end)"));
+    CHECK_THROWS_AS(stuck.resume(), budget_exceeded);
+    CHECK(stuck.get_status() == thread::status::dead);
+  }
+}
+
+TEST_CASE("Profiling", "[state]")
+{
+  using namespace lua;
+  const state s;
+
+  s.do_string(R"lua(
+    function leaf() local n = 0 for i = 1, 100 do n = n + i end return n end
+    function branch() for i = 1, 1000 do leaf() end end
+  )lua");
+  const auto leaf = get(s.global_table(), "leaf");
+  set(s.global_table(), "callback", function([&] {
+        for (int i = 0; i < 1000; ++i)
+          std::get<function>(leaf.as_variant()).call(tuple{});
+      }));
+
+  s.start_profiler(100);
+  s.do_string("branch() callback()");
+  s.stop_profiler();
+  const auto folded = s.folded_profile();
+
+  // one "frames count" line per stack, from the outermost frame.
+  std::size_t samples = 0;
+  std::istringstream lines(folded);
+  for (std::string line; std::getline(lines, line);) {
+    const auto space = line.rfind(' ');
+    REQUIRE(space != std::string::npos);
+    samples += std::stoul(line.substr(space + 1));
+  }
+  CHECK(samples > 1000);
+
+  CHECK(folded.find("branch (") != std::string::npos);
+  CHECK(folded.find(";leaf (") != std::string::npos);
+  // called from C++, leaf is only known by where it is defined.
+  CHECK(folded.find("callback [C++];([string") != std::string::npos);
+
+  // stopped profilers take no samples.
+  s.do_string("branch()");
+  CHECK(s.folded_profile() == folded);
+
+  s.start_profiler();
+  CHECK(s.folded_profile().empty());
+  s.stop_profiler();
+}
+
+TEST_CASE("Internal counters", "[state]")
+{
+  using namespace lua;
+  const state s;
+  const auto before = s.stats();
+
+  s.do_string("t = setmetatable({}, {__mode = 'k'})");
+  {
+    const auto t = get(s.global_table(), "t");
+    const value x = s.do_string("return 'short', 42, {}")[0];
+    const auto u = s.create_userdata(42);
+    set(s.global_table(), "f", function([](std::string) {}));
+    s.do_string("f('abc')");
+
+    // more results than the stack has room for.
+    set(s.global_table(), "many", function([] {
+          tuple t;
+          t.resize(1000);
+          return t;
+        }));
+    s.do_string("many()");
+  }
+  s.do_string("u = nil collectgarbage()");
+  s.collect_refs();
+
+  const auto after = s.stats();
+#ifdef LUAPP_STATS
+  CHECK(after.compilations == before.compilations + 5);
+  CHECK(after.conversions[LUA_TSTRING] > before.conversions[LUA_TSTRING]);
+  CHECK(after.conversions[LUA_TTABLE] > before.conversions[LUA_TTABLE]);
+  CHECK(after.strings_copied >= before.strings_copied + 2);
+  CHECK(after.string_bytes >= before.string_bytes + 8);
+  CHECK(after.closures_created == before.closures_created + 2);
+  CHECK(after.userdata_created == before.userdata_created + 1);
+  CHECK(after.userdata_finalized == before.userdata_finalized + 1);
+  CHECK(after.stack_growths > before.stack_growths);
+
+  // every handle above has been dropped.
+  CHECK(after.refs_created > before.refs_created);
+  CHECK(after.live_refs() == before.live_refs());
+#else
+  CHECK(after.refs_created == 0);
+  CHECK(after.compilations == 0);
+  CHECK(before.live_refs() == 0);
+#endif
+}
+
+TEST_CASE("Latency metrics", "[state]")
+{
+  using namespace lua;
+  const state s;
+
+  // nothing is recorded until asked for, nor for the chunks loaded before.
+  s.do_string("return 1", "=early");
+  chunk early = s.load("return 1", "=early");
+  const auto metrics = s.metrics();
+  early();
+  CHECK(metrics->prometheus().empty());
+
+  for (int i = 0; i < 10; ++i)
+    s.do_string("local n = 0 for i = 1, 1000 do n = n + i end", "=sum");
+  CHECK_THROWS(s.do_string("error('boom')", "@fails.lua"));
+
+  chunk c = s.load("return 42", "answer");
+  c();
+  c();
+
+  set(s.global_table(), "wait", metrics->timed("wait", [](int us) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+      }));
+  s.do_string("for i = 1, 5 do wait(200) end");
+
+  const auto sum = metrics->chunk_latency("sum");
+  CHECK(sum->count() == 10);
+  CHECK(sum->sum() > 0);
+  CHECK(metrics->chunk_latency("fails.lua")->count() == 1);
+  CHECK(metrics->chunk_latency("answer")->count() == 2);
+
+  // as are the chunks of the compiler cache.
+  s.set_chunk_cache(4);
+  for (int i = 0; i < 3; ++i)
+    s.do_string("return 1", "=cached");
+  CHECK(metrics->chunk_latency("cached")->count() == 3);
+
+  const auto wait = metrics->function_latency("wait");
+  CHECK(wait->count() == 5);
+  CHECK(wait->quantile(0.5) >= 200'000);
+  CHECK(wait->quantile(0.5) <= wait->quantile(0.99));
+  CHECK(wait->sum() >= 1'000'000);
+
+  const auto text = metrics->prometheus();
+  CHECK(text.find("# TYPE luapp_chunk_duration_seconds summary") != std::string::npos);
+  CHECK(text.find("luapp_chunk_duration_seconds{chunk=\"sum\",quantile=\"0.99\"} ") !=
+        std::string::npos);
+  CHECK(text.find("luapp_chunk_duration_seconds_count{chunk=\"sum\"} 10\n") !=
+        std::string::npos);
+  CHECK(text.find("luapp_function_duration_seconds_count{function=\"wait\"} 5\n") !=
+        std::string::npos);
+  CHECK(text.find("early") == std::string::npos);
+}
+
+TEST_CASE("Histograms", "[state]")
+{
+  lua::histogram h;
+  CHECK(h.quantile(0.5) == 0);
+
+  for (std::uint64_t ns = 1; ns <= 1000; ++ns)
+    h.record(ns);
+  CHECK(h.count() == 1000);
+  CHECK(h.sum() == 500'500);
+
+  // exact below 32ns, and within 1/32 above.
+  CHECK(h.quantile(0.01) == 10);
+  CHECK(h.quantile(0.5) >= 500);
+  CHECK(h.quantile(0.5) <= 500 + 500 / 32);
+  CHECK(h.quantile(1.0) >= 1000);
+  CHECK(h.quantile(1.0) <= 1000 + 1000 / 32);
+
+  // huge values are clamped rather than lost.
+  h.record(std::uint64_t{1} << 50);
+  CHECK(h.count() == 1001);
+  CHECK(h.quantile(1.0) < std::uint64_t{1} << 41);
+}
+
+TEST_CASE("References outliving their state", "[state]")
+{
+  using namespace lua;
+
+  std::optional<value> t, f, u;
+  {
+    const state s;
+    t = s.create_table();
+    f = s.do_string("return function() end");
+    u = s.create_userdata(42);
+
+    auto copy = *t;
+    CHECK(copy == *t);
+  }
+
+  // releasing them after the state is closed is harmless.
+  auto copy = *t;
+  t.reset();
+  f.reset();
+  u.reset();
+}
+
+TEST_CASE("Releasing references from other threads", "[state]")
+{
+  using namespace lua;
+
+  const state s;
+  const auto registry_size = [&] {
+    return s.do_string("return #debug.getregistry()")[0].get_integer_or(0);
+  };
+
+  const auto make_tables = [&](std::size_t n) {
+    std::vector<value> tables;
+    for (std::size_t i = 0; i < n; ++i)
+      tables.emplace_back(s.create_table());
+    return tables;
+  };
+
+  auto batch = make_tables(1000);
+  const auto size = registry_size();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    // moved, not copied: handles are only copied on the thread that created the state.
+    auto part = std::vector<value>(std::make_move_iterator(batch.begin() + i * 250),
+                                   std::make_move_iterator(batch.begin() + (i + 1) * 250));
+    threads.emplace_back([part = std::move(part)]() mutable { part.clear(); });
+  }
+  batch.clear();
+
+  // the Lua thread keeps collecting meanwhile.
+  for (int i = 0; i < 100; ++i)
+    s.collect_refs();
+
+  for (auto& t : threads)
+    t.join();
+  s.collect_refs();
+
+  // the freed slots are reused.
+  const auto again = make_tables(1000);
+  CHECK(registry_size() <= size);
+
+  // copies dropped elsewhere while the owner keeps copying the same handles.
+  const auto kept = make_tables(100);
+  threads.clear();
+  for (int i = 0; i < 4; ++i)
+    threads.emplace_back([copies = kept]() mutable { copies.clear(); });
+  for (int i = 0; i < 100; ++i) {
+    const auto copies = kept;
+    s.collect_refs();
+  }
+  for (auto& t : threads)
+    t.join();
+  s.collect_refs();
+
+  for (const auto& t : kept) {
+    set(t.get_table_or(s.create_table()), "x", integer{1});
+    CHECK(get(t.get_table_or(s.create_table()), "x") == integer{1});
+  }
+}
@@ -0,0 +1,96 @@
+#include <catch.hpp>
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <latch>
+#include <luapp/state.hpp>
+#include <luapp/state_pool.hpp>
+#include <luapp/value.hpp>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("State pools", "[state_pool]")
+{
+  using namespace lua;
+
+  state_pool pool(4, [](const state& s) {
+    s.do_string("function add(a, b) return a + b end");
+    s.do_string("function self() return tostring({}):rep(300) end");
+  });
+  CHECK(pool.size() == 4);
+
+  SECTION("futures")
+  {
+    std::vector<std::future<tuple>> results;
+    for (integer i = 0; i < 100; ++i)
+      results.push_back(pool.call("add", tuple{i, integer{1}}));
+
+    for (integer i = 0; i < 100; ++i)
+      CHECK(results[i].get()[0] == i + 1);
+
+    // large strings are copied out of their state.
+    const value s = pool.call("self", tuple{}).get();
+    CHECK(s.is<string>());
+
+    CHECK(pool.run("return 'a', 2, true").get().size() == 3);
+  }
+
+  SECTION("errors")
+  {
+    CHECK_THROWS_AS(pool.run("error('boom')").get(), std::runtime_error);
+    CHECK_THROWS_AS(pool.run("return {}").get(), std::runtime_error);
+    CHECK_THROWS_AS(pool.run("return coroutine.create(function() end)").get(),
+                    std::runtime_error);
+    CHECK_THROWS_AS(pool.call("missing", tuple{}).get(), std::runtime_error);
+    CHECK_THROWS_AS(pool.submit([](const state&) -> int { throw std::logic_error{""}; }).get(),
+                    std::logic_error);
+  }
+
+  SECTION("callbacks")
+  {
+    std::latch done(2);
+    std::atomic<bool> ok = true;
+
+    pool.call("add", tuple{integer{1}, integer{2}}, [&](std::exception_ptr e, tuple t) {
+      ok = ok && !e && t[0] == integer{3};
+      done.count_down();
+    });
+    pool.run("error('boom')", [&](std::exception_ptr e, tuple) {
+      ok = ok && e;
+      done.count_down();
+    });
+
+    done.wait();
+    CHECK(ok);
+  }
+
+  SECTION("each state stays on its thread")
+  {
+    // blocks all workers at once, so that each of them takes one job.
+    std::latch all(4);
+    std::vector<std::future<std::thread::id>> ids;
+    for (int i = 0; i < 4; ++i)
+      ids.push_back(pool.submit([&](const state&) {
+        all.arrive_and_wait();
+        return std::this_thread::get_id();
+      }));
+
+    std::set<std::thread::id> threads;
+    for (auto& id : ids)
+      threads.insert(id.get());
+    CHECK(threads.size() == 4);
+  }
+}
+
+TEST_CASE("State pool setup failures", "[state_pool]")
+{
+  using namespace lua;
+
+  CHECK_THROWS_AS(state_pool(2, [](const state& s) { s.do_string("error('setup')"); }),
+                  std::runtime_error);
+  CHECK_THROWS_AS(state_pool(0), std::invalid_argument);
+}
@@ -0,0 +1,218 @@
+#include <catch.hpp>
+
+#include <array>
+#include <cstdint>
+#include <luapp/pairs.hpp>
+#include <luapp/state.hpp>
+#include <luapp/value.hpp>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+TEST_CASE("Reading table fields", "[table]")
+{
+  using namespace lua;
+
+  const state s;
+  const value v = s.do_string(R"lua(
+    return {
+      i = 1, f = 1.5, b = false, s = "one",
+      t = { x = 1 }, fn = function() return 2 end,
+    }
+  )lua");
+
+  REQUIRE(v.is_table());
+  const auto t = *static_cast<std::optional<table>>(v);
+
+  CHECK(get(t, "i") == integer{1});
+  CHECK(get(t, "f") == floating{1.5});
+  CHECK(get(t, "b") == false);
+  CHECK(get(t, "s") == "one");
+  CHECK(get(t, "missing").is_nil());
+
+  {
+    const std::optional<table> inner = get(t, "t");
+    REQUIRE(inner);
+    CHECK(get(*inner, "x") == integer{1});
+  }
+
+  {
+    std::optional<function> fn = get(t, "fn");
+    REQUIRE(fn);
+
+    const value r = (*fn)();
+    CHECK(r == integer{2});
+  }
+}
+
+TEST_CASE("Iterating over tables", "[table]")
+{
+  using namespace lua;
+
+  const state s;
+  const value v = s.do_string(R"lua(
+    return { 10, 20, 30, nil, 50, x = "x", y = "y" }
+  )lua");
+
+  REQUIRE(v.is_table());
+  const auto t = *static_cast<std::optional<table>>(v);
+
+  {
+    integer sum = 0;
+    std::size_t strings = 0, count = 0;
+
+    for (const auto& [key, val] : pairs(t)) {
+      ++count;
+      if (key.is_integer())
+        sum += val.get_integer_or(0);
+      else if (key.is_string() && val == key)
+        ++strings;
+    }
+
+    CHECK(count == 6);
+    CHECK(sum == 110);
+    CHECK(strings == 2);
+  }
+
+  {
+    integer sum = 0, last = 0;
+    for (const auto& [i, val] : ipairs(t)) {
+      CHECK(i == last + 1);
+      last = i;
+      sum += val.get_integer_or(0);
+    }
+
+    // stops at the first hole.
+    CHECK(last == 3);
+    CHECK(sum == 60);
+  }
+
+  {
+    // nested and interrupted traversals keep the stack balanced.
+    std::size_t count = 0;
+    for (const auto& [i, outer] : ipairs(t)) {
+      CHECK(outer.is_integer());
+      for (const auto& [key, inner] : pairs(t)) {
+        CHECK(!inner.is_nil());
+        if (++count % 2 == 0)
+          break;
+      }
+    }
+    CHECK(count == 6);
+    CHECK(s.do_string("return 1").size() == 1);
+  }
+
+  {
+    const auto empty = s.create_table();
+    std::size_t count = 0;
+    for (const auto& entry : pairs(empty))
+      count += entry.second.is_nil() ? 1 : 2;
+    for (const auto& entry : ipairs(empty))
+      count += entry.second.is_nil() ? 1 : 2;
+    CHECK(count == 0);
+  }
+}
+
+TEST_CASE("Bulk array transfer", "[table]")
+{
+  using namespace lua;
+
+  const state s;
+  const table g = s.global_table();
+
+  {
+    const std::vector<int> xs = {1, 2, 3, 4};
+    set(g, "xs", s.create_table_from(xs));
+
+    const value sum = s.do_string("local s = 0 for _, x in ipairs(xs) do s = s + x end return s");
+    CHECK(sum == integer{10});
+    CHECK(s.do_string("return #xs")[0] == integer{4});
+  }
+
+  {
+    const std::array<double, 3> xs = {0.5, 1.5, 2.5};
+    const auto t = s.create_table_from(std::span<const double>(xs));
+    CHECK(t.to_vector<double>() == std::vector<double>{0.5, 1.5, 2.5});
+
+    std::array<float, 2> ys{};
+    CHECK(t.copy_to(std::span<float>(ys)) == 2);
+    CHECK(ys[1] == 1.5f);
+  }
+
+  {
+    const std::vector<std::string> xs = {"a", std::string("b\0c", 3)};
+    const auto t = s.create_table_from(xs);
+    CHECK(t.to_vector<std::string>() == xs);
+  }
+
+  {
+    const value v = s.do_string(R"( return {1, 2.0, "3", true} )");
+    const auto t = *static_cast<std::optional<table>>(v);
+
+    CHECK_THROWS(t.to_vector<integer>());
+    CHECK_THROWS(t.to_vector<integer>(conversion::coerce)); // true is not a number
+
+    std::array<integer, 3> xs{};
+    CHECK(t.copy_to(std::span<integer>(xs), conversion::coerce) == 3);
+    CHECK(xs == std::array<integer, 3>{1, 2, 3});
+
+    CHECK(t.to_vector<bool>(conversion::coerce) == std::vector<bool>{true, true, true, true});
+    CHECK_THROWS(t.to_vector<std::string>(conversion::coerce)); // nor a string
+  }
+
+  {
+    // out of range for the element type.
+    const auto t = s.create_table_from(std::vector<integer>{300});
+    CHECK_THROWS(t.to_vector<std::uint8_t>());
+    CHECK(t.to_vector<std::int16_t>() == std::vector<std::int16_t>{300});
+  }
+
+  CHECK(s.do_string("return 1").size() == 1);
+}
+
+TEST_CASE("Interned keys", "[table]")
+{
+  using namespace lua;
+
+  const state s;
+  const auto name = s.create_key("name");
+  const auto weird = s.create_key(std::string_view("a\0b", 3));
+
+  CHECK(name.name() == "name");
+  CHECK(weird.name().size() == 3);
+
+  const auto t = s.create_table();
+  set(t, name, "luapp");
+  set(t, weird, integer{3});
+
+  CHECK(get(t, name) == "luapp");
+  CHECK(get(t, "name") == "luapp");
+  CHECK(get(t, weird) == integer{3});
+  CHECK(get(s.create_table(), name).is_nil());
+
+  set(s.global_table(), "t", t);
+  const value n = s.do_string(R"(return t["a\0b"])");
+  CHECK(n == integer{3});
+
+  SECTION("metamethods are respected")
+  {
+    const value proxy = s.do_string(R"(
+      return setmetatable({}, { __index = function(_, k) return k .. "!" end })
+    )");
+    const auto p = *static_cast<std::optional<table>>(proxy);
+    CHECK(get(p, name) == "name!");
+  }
+
+  SECTION("keys outlive their copies")
+  {
+    auto copy = name;
+    {
+      const auto other = s.create_key("other");
+      copy = other;
+    }
+    s.do_string("collectgarbage()");
+    set(t, copy, true);
+    CHECK(get(t, "other") == true);
+  }
+}
@@ -0,0 +1,293 @@
+#include <catch.hpp>
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <luapp/scheduler.hpp>
+#include <luapp/state.hpp>
+#include <luapp/task.hpp>
+#include <luapp/thread.hpp>
+#include <luapp/userdata.hpp>
+#include <luapp/value.hpp>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+TEST_CASE("Coroutines", "[thread]")
+{
+  using namespace lua;
+  state s;
+
+  const auto counter = s.load(R"lua(
+    local n = ...
+    for i = 1, n do
+      local step = coroutine.yield(i)
+      if step then n = n + step end
+    end
+    return "done", n
+  )lua");
+
+  SECTION("resume and status")
+  {
+    const auto co = s.create_thread(counter);
+    CHECK(co.get_status() == thread::status::suspended);
+
+    CHECK(co.resume(tuple{integer{2}})[0] == integer{1});
+    CHECK(co.get_status() == thread::status::suspended);
+
+    // values passed to resume are the results of yield.
+    CHECK(co.resume(tuple{integer{1}})[0] == integer{2});
+
+    const auto [a, b] = co.resume().expand(returns<2>);
+    CHECK(a == "done");
+    CHECK(b == integer{3});
+    CHECK(co.get_status() == thread::status::dead);
+
+    CHECK_THROWS_AS(co.resume(), std::runtime_error);
+  }
+
+  SECTION("errors")
+  {
+    const auto co = s.create_thread(s.load("coroutine.yield() error('boom')"));
+    CHECK(co.resume().size() == 0);
+    CHECK_THROWS_AS(co.resume(), std::runtime_error);
+    CHECK(co.get_status() == thread::status::dead);
+  }
+
+  SECTION("coroutines created in Lua")
+  {
+    const value v = s.do_string("return coroutine.create(function(a) coroutine.yield(a * 2) end)");
+    REQUIRE(v.is_thread());
+
+    const auto co = v.get_thread_or(s.create_thread(counter));
+    CHECK(co.resume(tuple{integer{21}})[0] == integer{42});
+    CHECK(co.resume().size() == 0);
+    CHECK(co.get_status() == thread::status::dead);
+
+    // and back to Lua.
+    set(s.global_table(), "co", co);
+    CHECK(s.do_string("return coroutine.status(co)")[0] == "dead");
+  }
+
+  SECTION("C++ functions in coroutines")
+  {
+    std::vector<integer> seen;
+    set(s.global_table(), "see", function([&seen](integer i) { seen.push_back(i); }));
+
+    const auto co = s.create_thread(s.load("for i = 1, 3 do see(i) coroutine.yield() end"));
+    while (co.get_status() == thread::status::suspended)
+      co.resume();
+    CHECK(seen == std::vector<integer>{1, 2, 3});
+  }
+
+  SECTION("userdata across resume")
+  {
+    const auto co = s.create_thread(s.load("local u = coroutine.yield() return u, echo(u)"));
+    set(s.global_table(), "echo", function([](const value& u) { return u; }));
+
+    const auto u = s.create_userdata(std::in_place_type<int>);
+    co.resume();
+    const auto [a, b] = co.resume(tuple{u}).expand(returns<2>);
+    CHECK(a == u);
+    CHECK(b == u);
+  }
+}
+
+TEST_CASE("Scheduling coroutines", "[thread]")
+{
+  using namespace lua;
+  state s;
+
+  const auto session = s.load(R"lua(
+    local id = ...
+    for i = 1, 3 do coroutine.yield(id, i) end
+    return id
+  )lua");
+
+  scheduler sched;
+  std::vector<std::string> trace;
+
+  const auto run_session = [&](integer id) -> task<> {
+    const auto co = s.create_thread(session);
+    auto t = co_await sched.resume(co, tuple{id});
+    while (co.get_status() == thread::status::suspended) {
+      trace.push_back(std::to_string(t[0].get_integer_or(0)) + ":" +
+                      std::to_string(t[1].get_integer_or(0)));
+      t = co_await sched.resume(co);
+    }
+  };
+
+  sched.spawn(run_session(1));
+  sched.spawn(run_session(2));
+  CHECK(sched.size() == 2);
+  sched.run();
+  CHECK(sched.size() == 0);
+
+  // the sessions are interleaved at every yield.
+  CHECK(trace == std::vector<std::string>{"1:1", "2:1", "1:2", "2:2", "1:3", "2:3"});
+
+  // nested tasks and errors.
+  const auto fail = []() -> task<int> {
+    throw std::runtime_error{"failed"};
+    co_return 0;
+  };
+  const auto outer = [&]() -> task<> {
+    co_await sched.yield();
+    co_await fail();
+  };
+
+  sched.spawn(outer());
+  CHECK_THROWS_AS(sched.run(), std::runtime_error);
+  CHECK(sched.size() == 0);
+
+  // unfinished tasks are destroyed with the scheduler.
+  {
+    scheduler other;
+    other.spawn(run_session(3));
+  }
+}
+
+namespace
+{
+// An I/O source completed by hand: reads wait until the test answers them.
+class fake_io
+{
+public:
+  explicit fake_io(lua::scheduler& sched) : sched_(&sched) {}
+
+  auto read(std::string key) -> lua::task<std::string>
+  {
+    request r{std::move(key), false, {}};
+    co_await awaiter{this, &r};
+    if (r.failed)
+      throw std::runtime_error{"cannot read " + r.key};
+    co_return r.key + "!";
+  }
+
+  auto pending() const -> std::size_t { return requests_.size(); }
+
+  // Answers every pending read, failing those for `bad`.
+  auto complete(const std::string& bad = {}) -> void
+  {
+    for (auto* r : std::exchange(requests_, {})) {
+      r->failed = r->key == bad;
+      sched_->schedule(r->waiting);
+    }
+  }
+
+private:
+  struct request
+  {
+    std::string key;
+    bool failed = false;
+    std::coroutine_handle<> waiting;
+  };
+
+  struct awaiter
+  {
+    fake_io* io;
+    request* r;
+
+    auto await_ready() const noexcept -> bool { return false; }
+    auto await_suspend(std::coroutine_handle<> h) -> void
+    {
+      r->waiting = h;
+      io->requests_.push_back(r);
+    }
+    auto await_resume() const noexcept -> void {}
+  };
+
+  lua::scheduler* sched_;
+  std::vector<request*> requests_;
+};
+} // namespace
+
+TEST_CASE("Yieldable functions", "[thread]")
+{
+  using namespace lua;
+  state s;
+  scheduler sched;
+  fake_io io(sched);
+
+  set(s.global_table(), "fetch", sched.async([&io](std::string key) { return io.read(key); }));
+
+  const auto session = s.load(R"lua(
+    local a = fetch("a" .. ...)
+    local ok, err = pcall(fetch, "bad")
+    return a .. fetch("b"), ok, err
+  )lua");
+
+  std::vector<std::string> results;
+  const auto run_session = [&](integer id) -> task<> {
+    const auto co = s.create_thread(session);
+    const auto t = co_await sched.resume(co, tuple{id});
+    CHECK(co.get_status() == thread::status::dead);
+    CHECK(t[1] == boolean{false});
+    results.push_back(t[0].get_string_or("") + " " + t[2].get_string_or(""));
+  };
+
+  constexpr integer sessions = 100;
+  for (integer i = 0; i < sessions; ++i)
+    sched.spawn(run_session(i));
+
+  // every session waits on its own read at once.
+  for (int step = 0; step < 3; ++step) {
+    sched.poll();
+    CHECK(io.pending() == sessions);
+    io.complete("bad");
+  }
+  sched.poll();
+  CHECK(sched.size() == 0);
+
+  REQUIRE(results.size() == sessions);
+  CHECK(results[0].starts_with("a0!b! "));
+  CHECK(results[0].find("cannot read bad") != std::string::npos);
+
+  SECTION("outside a scheduler")
+  {
+    CHECK_THROWS_AS(s.do_string("fetch('a')"), std::runtime_error);
+    CHECK_THROWS_AS(s.create_thread(s.load("fetch('a')")).resume(), std::runtime_error);
+    CHECK(io.pending() == 0);
+  }
+
+  SECTION("timers and other threads")
+  {
+    std::vector<std::thread> workers;
+    set(s.global_table(), "sleep", sched.async([&](integer ms) -> task<> {
+          co_await sched.sleep_for(std::chrono::milliseconds(ms));
+        }));
+
+    struct background
+    {
+      std::vector<std::thread>* workers;
+      scheduler* sched;
+
+      auto await_ready() const noexcept -> bool { return false; }
+      auto await_suspend(std::coroutine_handle<> h) -> void
+      {
+        workers->emplace_back([s = sched, h] { s->post(h); });
+      }
+      auto await_resume() const noexcept -> integer { return 42; }
+    };
+    set(s.global_table(), "compute", sched.async([&]() -> task<integer> {
+          co_return co_await background{&workers, &sched};
+        }));
+
+    integer answer = 0;
+    const auto script = [&]() -> task<> {
+      const auto co = s.create_thread(s.load("sleep(5) return compute()"));
+      answer = (co_await sched.resume(co))[0].get_integer_or(0);
+    };
+    sched.spawn(script());
+
+    const auto start = scheduler::clock::now();
+    sched.run();
+    CHECK(scheduler::clock::now() - start >= std::chrono::milliseconds(5));
+    CHECK(answer == 42);
+
+    for (auto& w : workers)
+      w.join();
+  }
+}
@@ -2,8 +2,13 @@
 
 #include <luapp/state.hpp>
 #include <luapp/value.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 TEST_CASE("Basic value manipulation", "[value]")
 {
@@ -168,3 +173,122 @@ TEST_CASE("Functions", "[value]")
     }
   }
 }
+
+TEST_CASE("Strings read from Lua", "[value]")
+{
+  using namespace lua;
+
+  const state s;
+
+  SECTION("embedded zeros")
+  {
+    const value v = s.do_string(R"(return "a\0b\0c")");
+    CHECK(v.is_string());
+    CHECK(v.get_string_or("") == std::string("a\0b\0c", 5));
+    CHECK(v == value(std::string("a\0b\0c", 5)));
+  }
+
+  SECTION("large strings")
+  {
+    const value large = s.do_string("return string.rep('x', 1000) .. '\\0'");
+    REQUIRE(large.is<string>());
+
+    const std::string expected = std::string(1000, 'x') + '\0';
+    CHECK(large.get_or<string>("") == expected);
+    CHECK(std::get<string>(large.as_variant()) == expected);
+    CHECK(std::visit([](const auto& v) { return std::is_same_v<decltype(v), const string&>; },
+                     large.as_variant()));
+    CHECK(large.get_string_view_or("") == expected);
+
+    // a view of a temporary would dangle
+    static_assert(std::is_convertible_v<const value&, std::optional<std::string_view>>);
+    static_assert(!std::is_convertible_v<value, std::optional<std::string_view>>);
+    CHECK(large == value(expected));
+  }
+
+  SECTION("bound function parameters")
+  {
+    function f = +[](std::optional<std::string_view> text) -> integer {
+      return text ? static_cast<integer>(text->size()) : -1;
+    };
+    set(s.global_table(), "f", f);
+
+    const auto [a, b, c] = s.do_string(returns<3>, R"(
+      return f(string.rep('y', 5000)), f("a\0b"), f(nil)
+    )");
+    CHECK(a == integer{5000});
+    CHECK(b == integer{3});
+    CHECK(c == integer{-1});
+  }
+}
+
+TEST_CASE("Tuples", "[value]")
+{
+  using namespace lua;
+
+  const auto check_values = [](const tuple& t, std::size_t n) {
+    REQUIRE(t.size() == n);
+    for (std::size_t i = 0; i < n; ++i)
+      CHECK(t[i] == integer(i));
+    CHECK(t[n].is_nil());
+    CHECK(t.at(n + 100).is_nil());
+  };
+
+  {
+    const tuple t;
+    CHECK(t.size() == 0);
+    CHECK(static_cast<const value&>(t).is_nil());
+  }
+
+  {
+    const tuple t{integer{0}, integer{1}};
+    check_values(t, 2);
+    CHECK(static_cast<const value&>(t) == integer{0});
+
+    const auto [a, b, c] = t.expand(returns<3>);
+    CHECK(a == integer{0});
+    CHECK(b == integer{1});
+    CHECK(c.is_nil());
+  }
+
+  // growing past the inline capacity and shrinking back keep the values.
+  for (const auto n : {std::size_t{1}, tuple::inline_capacity, tuple::inline_capacity + 1,
+                       4 * tuple::inline_capacity}) {
+    tuple t;
+    t.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+      t[i] = integer(i);
+    check_values(t, n);
+
+    auto copy = t;
+    copy.resize(2 * n);
+    for (std::size_t i = n; i < 2 * n; ++i) {
+      CHECK(copy[i].is_nil());
+      copy[i] = integer(i);
+    }
+    check_values(copy, 2 * n);
+
+    copy.resize(1);
+    check_values(copy, 1);
+    copy.resize(n);
+    CHECK(copy[n - 1].is_nil() == (n > 1));
+
+    auto moved = std::move(t);
+    check_values(moved, n);
+    // moved-from tuples are empty, even past the inline capacity.
+    check_values(t, 0);
+
+    t = std::move(moved);
+    check_values(t, n);
+    check_values(moved, 0);
+    moved.resize(n + 1);
+    CHECK(moved[n].is_nil());
+  }
+
+  {
+    std::vector<value> values;
+    for (integer i = 0; i < 10; ++i)
+      values.push_back(i);
+    check_values(tuple(std::move(values)), 10);
+  }
+}